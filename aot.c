@@ -0,0 +1,57 @@
+#include "aot.h"
+
+aotFunction blockTable[0x8000];
+
+// Index the linked program by address. Fails if there is none or it was
+// made from a different ROM.
+bool initializeAOT() {
+  uint32_t i;
+
+  if (&compiledProgram == NULL) {
+    printf("Error: no recompiled ROM linked in\n");
+    return false;
+  }
+  if (compiledProgram.romChecksum != romChecksum()) {
+    printf("Error: recompiled code is for a different ROM\n");
+    return false;
+  }
+
+  memset(blockTable, 0, sizeof(blockTable));
+  for (i = 0; i < compiledProgram.blockCount; i++) {
+    blockTable[compiledProgram.blocks[i].address] = compiledProgram.blocks[i].function;
+  }
+  return true;
+}
+
+// Blocks were translated from the ROM file as it maps at power-on with the
+// boot ROM gone, so they only stand in for what the CPU would fetch while
+// that is still what is mapped.
+bool blockUsable(uint16_t address) {
+  if (address < 0x0100 && memory[0xFF50] == 0) {
+    return false;
+  }
+  if (address >= 0x4000 && mbc.type != MBC_NONE && mbc.romBank % romBanks != 1) {
+    return false;
+  }
+  return patchPage[address >> 8] == NULL;
+}
+
+// Run the block at pc, or one instruction through step() where there is
+// none to use.
+void stepAOT() {
+  aotFunction block = pc < 0x8000 && !prefixCB ? blockTable[pc] : NULL;
+  if (block != NULL && blockUsable(pc)) {
+    block();
+  }
+  else {
+    step();
+  }
+}
+
+void runFrameAOT() {
+  beginFrame();
+  while (cycles < cycleLimit) {
+    stepAOT();
+  }
+  endFrame();
+}
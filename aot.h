@@ -0,0 +1,50 @@
+#ifndef AOT_H_INCLUDED
+#define AOT_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cartridge.h"
+#include "cpu.h"
+#include "metrics.h"
+
+// A ROM translated to C by tools/recompile. Each block runs straight-line
+// code from its address, one instruction at a time with the same event and
+// interrupt handling as step(), and returns as soon as pc goes anywhere
+// other than the next instruction or the frame ends.
+typedef void (*aotFunction)(void);
+
+typedef struct {
+  uint16_t address;
+  aotFunction function;
+} aotBlock;
+
+typedef struct {
+  uint32_t romChecksum;
+  uint32_t blockCount;
+  const aotBlock *blocks;
+} aotProgram;
+
+// Defined by the generated file; NULL when none is linked in.
+extern const aotProgram compiledProgram __attribute__((weak));
+
+// What step() does after executeOpcode, plus the frame end check.
+#define AOT_STEP_END()				\
+  metrics.instructions++;			\
+  if (cycles >= nextEventCycle) {		\
+    runEvents();				\
+  }						\
+  if (interruptSignal) {			\
+    serviceInterrupts();			\
+  }
+
+#define AOT_NEXT(next)				\
+  AOT_STEP_END();				\
+  if (pc != (next) || cycles >= cycleLimit) {	\
+    return;					\
+  }
+
+bool initializeAOT(void);
+void stepAOT(void);
+void runFrameAOT(void);
+
+#endif
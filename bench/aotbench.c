@@ -0,0 +1,63 @@
+// Frames/sec of the interpreter against the same ROM recompiled to C, and
+// a check that both leave the machine in the same state.
+//
+//   cc -O2 -I.. -o recompile ../tools/recompile.c ../aot.c ../boot.c ../capture.c ../cartridge.c ../cgb.c ../cheats.c ../cpu.c ../debugger.c ../dma.c ../flags.c ../interrupts.c ../joypad.c ../memory.c ../metrics.c ../pipeline.c ../ppu.c ../render.c ../savestate.c ../scheduler.c ../shm.c ../statehash.c ../timer.c ../until.c -lm -lrt -lpthread
+//   ./recompile game.gb ../cpu.c game_aot.c
+//   cc -O2 -I.. -o aotbench aotbench.c game_aot.c ../aot.c ../boot.c ../capture.c ../cartridge.c ../cgb.c ../cheats.c ../cpu.c ../debugger.c ../dma.c ../flags.c ../interrupts.c ../joypad.c ../memory.c ../metrics.c ../pipeline.c ../ppu.c ../render.c ../savestate.c ../scheduler.c ../shm.c ../statehash.c ../timer.c ../until.c -lm -lrt -lpthread
+//   ./aotbench game.gb [frames]
+
+#include <time.h>
+#include "../aot.h"
+#include "../boot.h"
+#include "../savestate.h"
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double run(void (*runner)(void), long frames, machineState *state) {
+  long i;
+
+  fastBoot(MODEL_DMG);
+  double start = now();
+  for (i = 0; i < frames; i++) {
+    runner();
+  }
+  double elapsed = now() - start;
+  saveState(state);
+  return elapsed;
+}
+
+int main(int argc, const char* argv[]) {
+  long frames = argc > 2 ? atol(argv[2]) : 600;
+
+  if (argc < 2) {
+    printf("usage: %s <rom> [frames]\n", argv[0]);
+    return 1;
+  }
+  traceEnabled = false;
+  frameSkip = FRAME_SKIP_ALL;
+  if (!loadROM(argv[1]) || !initializeAOT()) {
+    return 1;
+  }
+
+  machineState *interpreted = malloc(sizeof(machineState));
+  machineState *compiled = malloc(sizeof(machineState));
+  double interpreterTime = run(runFrame, frames, interpreted);
+  double compiledTime = run(runFrameAOT, frames, compiled);
+
+  printf("frames: %ld, blocks: %u\n", frames, compiledProgram.blockCount);
+  printf("interpreter: %.0f frames/sec\n", frames / interpreterTime);
+  printf("compiled:    %.0f frames/sec (%.2fx)\n", frames / compiledTime,
+	 interpreterTime / compiledTime);
+
+  bool match = memcmp(interpreted, compiled, sizeof(machineState)) == 0;
+  if (!match) {
+    printf("compiled run ended in a different state\n");
+  }
+  free(interpreted);
+  free(compiled);
+  return match ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+// Clones/sec for in-process clones of a running instance and for forked
+// process clones, each clone running a frame with its own input the way a
+// tree search would expand a node. Clones must replay exactly like their
+// source given the same input.
+//
+//   cc -O2 -I.. -o clonebench clonebench.c ../instance.c ../boot.c ../capture.c ../cartridge.c ../cgb.c ../cheats.c ../cpu.c ../debugger.c ../dma.c ../flags.c ../interrupts.c ../joypad.c ../memory.c ../metrics.c ../pipeline.c ../ppu.c ../render.c ../savestate.c ../scheduler.c ../shm.c ../statehash.c ../timer.c ../until.c -lm -lrt -lpthread
+//   ./clonebench rom [clones] [warmup frames]
+
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "../boot.h"
+#include "../instance.h"
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    printf("usage: %s rom [clones] [warmup frames]\n", argv[0]);
+    return 2;
+  }
+  int count = argc > 2 ? atoi(argv[2]) : 2000;
+  int warmup = argc > 3 ? atoi(argv[3]) : 60;
+  static machineState expected, state;
+  instanceTemplate template;
+  gbInstance root, clone;
+  int i, mismatches = 0;
+  size_t copied = 0;
+
+  traceEnabled = false;
+  if (!loadROM(argv[1])) {
+    return 2;
+  }
+  fastBoot(MODEL_DMG);
+  if (!createTemplate(&template) || !createInstance(&template, &root)) {
+    return 2;
+  }
+  enterInstance(&root);
+  for (i = 0; i < warmup; i++) {
+    runFrame();
+  }
+
+  // what a clone should reach: root itself run one frame with input 0x01,
+  // done on a first clone so root stays put
+  if (!cloneInstance(&template, &root, &clone)) {
+    return 2;
+  }
+  leaveInstance(&root);
+  enterInstance(&clone);
+  setJoypad(0x01);
+  runFrame();
+  saveState(&expected);
+  leaveInstance(&clone);
+  freeInstance(&clone);
+  enterInstance(&root);
+
+  double cloning = 0;
+  double start = now();
+  for (i = 0; i < count; i++) {
+    double cloneStart = now();
+    if (!cloneInstance(&template, &root, &clone)) {
+      return 2;
+    }
+    cloning += now() - cloneStart;
+    copied += instanceResidentBytes(&clone);
+    leaveInstance(&root);
+    enterInstance(&clone);
+    setJoypad(i & 1 ? 0x02 : 0x01);
+    runFrame();
+    if (!(i & 1)) {
+      saveState(&state);
+      if (memcmp(&state, &expected, sizeof(state)) != 0) {
+	mismatches++;
+      }
+    }
+    leaveInstance(&clone);
+    freeInstance(&clone);
+    enterInstance(&root);
+  }
+  double cloneTime = now() - start;
+
+  int forkCount = count / 10 > 0 ? count / 10 : 1;
+  start = now();
+  for (i = 0; i < forkCount; i++) {
+    pid_t child = forkInstance();
+    if (child == 0) {
+      setJoypad(0x01);
+      runFrame();
+      saveState(&state);
+      _exit(memcmp(&state, &expected, sizeof(state)) != 0);
+    }
+    int status;
+    if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status)) {
+      mismatches++;
+    }
+  }
+  double forkTime = now() - start;
+
+  printf("arena: %zu bytes, root owns %zu\n", template.size, instanceResidentBytes(&root));
+  printf("in-process: %8.0f clone+frame/sec, %8.0f clones/sec alone, %zu bytes owned per clone after its frame\n",
+	 count / cloneTime, count / cloning, copied / count);
+  printf("fork:       %8.0f clone+frame/sec\n", forkCount / forkTime);
+  printf("%d clones differ from the expected state\n", mismatches);
+
+  leaveInstance(&root);
+  freeInstance(&root);
+  freeTemplate(&template);
+  return mismatches ? 1 : 0;
+}
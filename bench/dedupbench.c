@@ -0,0 +1,128 @@
+// Breadth-first search over joypad inputs that drops duplicate states by
+// their incremental Merkle hash, the way a tree search would. Every node's
+// incremental hash must match a full rehash from a fresh hasher; the times
+// of both are reported per node.
+//
+//   cc -O2 -I.. -o dedupbench dedupbench.c ../instance.c ../boot.c ../capture.c ../cartridge.c ../cgb.c ../cheats.c ../cpu.c ../debugger.c ../dma.c ../flags.c ../interrupts.c ../joypad.c ../memory.c ../metrics.c ../pipeline.c ../ppu.c ../render.c ../savestate.c ../scheduler.c ../shm.c ../statehash.c ../timer.c ../until.c -lm -lrt -lpthread
+//   ./dedupbench rom [depth] [frames per step] [max nodes]
+
+#include <time.h>
+#include "../boot.h"
+#include "../instance.h"
+#include "../statehash.h"
+
+typedef struct {
+  gbInstance instance;
+  stateHasher hasher;
+  uint64_t hash;
+} searchNode;
+
+static const uint8_t inputs[] = { 0, BUTTON_A, BUTTON_RIGHT, BUTTON_LEFT, BUTTON_START };
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    printf("usage: %s rom [depth] [frames per step] [max nodes]\n", argv[0]);
+    return 2;
+  }
+  int depth = argc > 2 ? atoi(argv[2]) : 6;
+  int frames = argc > 3 ? atoi(argv[3]) : 1;
+  int maxNodes = argc > 4 ? atoi(argv[4]) : 4000;
+  instanceTemplate template;
+  static stateHasher fresh;
+  stateSet seen;
+  searchNode **nodes = calloc(maxNodes, sizeof(searchNode *));
+  int count = 0, level, first, last, i, j, k;
+  int expanded = 0, duplicates = 0, mismatches = 0;
+  double incremental = 0, full = 0;
+
+  traceEnabled = false;
+  if (!loadROM(argv[1])) {
+    return 2;
+  }
+  fastBoot(MODEL_DMG);
+  if (!createTemplate(&template)) {
+    return 2;
+  }
+  initializeStateSet(&seen, sameInstance);
+
+  searchNode *root = calloc(1, sizeof(searchNode));
+  if (!createInstance(&template, &root->instance)) {
+    return 2;
+  }
+  initializeStateHasher(&root->hasher);
+  enterInstance(&root->instance);
+  useStateHasher(&root->hasher);
+  root->hash = hashState();
+  useStateHasher(NULL);
+  leaveInstance(&root->instance);
+  addState(&seen, root->hash, &root->instance);
+  nodes[count++] = root;
+
+  first = 0;
+  for (level = 0; level < depth && count < maxNodes; level++) {
+    last = count;
+    for (i = first; i < last && count < maxNodes; i++) {
+      for (j = 0; j < (int) sizeof(inputs) && count < maxNodes; j++) {
+	searchNode *parent = nodes[i];
+	searchNode *child = malloc(sizeof(searchNode));
+	if (!cloneInstance(&template, &parent->instance, &child->instance)) {
+	  return 2;
+	}
+	child->hasher = parent->hasher;
+	rebaseStateHasher(&child->hasher, parent->instance.arena, child->instance.arena, parent->instance.arenaSize);
+
+	enterInstance(&child->instance);
+	useStateHasher(&child->hasher);
+	setJoypad(inputs[j]);
+	for (k = 0; k < frames; k++) {
+	  runFrame();
+	}
+	double start = now();
+	child->hash = hashState();
+	incremental += now() - start;
+
+	start = now();
+	initializeStateHasher(&fresh);
+	useStateHasher(&fresh);
+	if (hashState() != child->hash) {
+	  mismatches++;
+	}
+	full += now() - start;
+	useStateHasher(NULL);
+	leaveInstance(&child->instance);
+	expanded++;
+
+	if (addState(&seen, child->hash, &child->instance)) {
+	  nodes[count++] = child;
+	} else {
+	  duplicates++;
+	  freeInstance(&child->instance);
+	  free(child);
+	}
+      }
+    }
+    printf("depth %d: %d nodes\n", level + 1, count - last);
+    first = last;
+  }
+
+  printf("%d expanded, %d unique, %d duplicates, %llu hash collisions\n", expanded, count, duplicates,
+	 (unsigned long long) seen.collisions);
+  printf("incremental hash: %.2f us/node, full hash: %.2f us/node\n", incremental / expanded * 1e6,
+	 full / expanded * 1e6);
+  printf("%d incremental hashes differ from a full rehash\n", mismatches);
+
+  for (i = 0; i < count; i++) {
+    freeInstance(&nodes[i]->instance);
+    free(nodes[i]);
+  }
+  free(nodes);
+  freeStateSet(&seen);
+  freeTemplate(&template);
+  return mismatches ? 1 : 0;
+}
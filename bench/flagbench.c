@@ -0,0 +1,264 @@
+// Checks the table-driven flag code against the setFlag/getBit code it
+// replaced, over every operand, A and starting F, and times both. The
+// times include setting up each case, which is the same for both.
+//
+//   cc -O2 -I.. -o flagbench flagbench.c ../boot.c ../capture.c ../cartridge.c ../cgb.c ../cheats.c ../cpu.c ../debugger.c ../dma.c ../flags.c ../interrupts.c ../joypad.c ../memory.c ../metrics.c ../pipeline.c ../ppu.c ../render.c ../savestate.c ../scheduler.c ../shm.c ../statehash.c ../timer.c ../until.c -lm -lrt -lpthread
+//   ./flagbench
+
+#include <time.h>
+#include "../boot.h"
+#include "../cpu.h"
+
+#define OPERAND_ADDRESS 0xC000
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//
+// The previous implementations, kept as the reference
+//
+
+uint8_t referenceBit(uint8_t value, uint8_t n) {
+  return (value & (uint8_t) pow(2,n)) >> n;
+}
+
+void referenceADD(uint8_t value) {
+  uint8_t registerValue = readReg(REG_A);
+  uint8_t result = registerValue + value;
+  setFlag('Z', result == 0);
+  setFlag('N', false);
+  setFlag('H', referenceBit(3, registerValue) && referenceBit(3, value));
+  setFlag('C', referenceBit(7, registerValue) && referenceBit(7, value));
+  writeReg(REG_A, result);
+}
+
+void referenceADC(uint8_t value) {
+  uint8_t registerValue = readReg(REG_A);
+  uint8_t result = registerValue + value + getFlag('C');
+  setFlag('Z', result == 0);
+  setFlag('N', false);
+  setFlag('H', referenceBit(3, registerValue) && referenceBit(3, value));
+  setFlag('C', referenceBit(7, registerValue) && referenceBit(7, value));
+  writeReg(REG_A, result);
+}
+
+void referenceSUB(uint8_t value) {
+  uint8_t registerValue = readReg(REG_A);
+  uint8_t result = registerValue - value;
+  setFlag('Z', result == 0);
+  setFlag('N', true);
+  setFlag('H', referenceBit(3, registerValue) || !referenceBit(3, value));
+  setFlag('C', referenceBit(7, registerValue) || !referenceBit(7, value));
+  writeReg(REG_A, result);
+}
+
+void referenceSBC(uint8_t value) {
+  uint8_t registerValue = readReg(REG_A);
+  uint8_t result = registerValue - value - getFlag('C');
+  setFlag('Z', result == 0);
+  setFlag('N', true);
+  setFlag('H', referenceBit(3, registerValue) || !referenceBit(3, value));
+  setFlag('C', referenceBit(7, registerValue) || !referenceBit(7, value));
+  writeReg(REG_A, result);
+}
+
+void referenceLogic(uint8_t result, bool halfCarry) {
+  writeReg(REG_A, result);
+  if (result == 0) {
+    setFlag('Z', true);
+  }
+  setFlag('N', false);
+  setFlag('H', halfCarry);
+  setFlag('C', false);
+}
+
+void referenceCP(uint8_t value) {
+  uint8_t registerValue = readReg(REG_A);
+  setFlag('Z', registerValue == value);
+  setFlag('N', true);
+  setFlag('H', referenceBit(3, registerValue) || !referenceBit(3, value));
+  setFlag('C', registerValue < value);
+}
+
+uint8_t referenceIncDec(uint8_t value, bool decrement) {
+  uint8_t result = decrement ? value - 1 : value + 1;
+  setFlag('Z', result == 0);
+  setFlag('N', decrement);
+  setFlag('H', decrement ? (value & 0xF) == 0 : (value & 0xF) == 0xF);
+  return result;
+}
+
+uint8_t referenceSWAP(uint8_t value) {
+  uint8_t result = (value << 2) | (value >> 2);
+  setFlag('Z', result == 0);
+  setFlag('N', 0);
+  setFlag('H', 0);
+  setFlag('C', 0);
+  return result;
+}
+
+// RL when keepZero is false, RLA when true
+uint8_t referenceRotateLeft(uint8_t value, bool throughCarry, bool keepZero) {
+  bool carry = referenceBit(value, 7);
+  value = (value << 1) | (throughCarry ? getFlag('C') : carry);
+  if (!keepZero || value == 0) {
+    setFlag('Z', value == 0);
+  }
+  setFlag('N', false);
+  setFlag('H', false);
+  setFlag('C', carry);
+  return value;
+}
+
+uint8_t referenceRotateRight(uint8_t value, bool throughCarry) {
+  bool carry = referenceBit(value, 0);
+  value = (value >> 1) | ((throughCarry ? getFlag('C') : carry) << 7);
+  if (value == 0) {
+    setFlag('Z', true);
+  }
+  setFlag('N', false);
+  setFlag('H', false);
+  setFlag('C', carry);
+  return value;
+}
+
+//
+// What is compared: each operation with A and F preset and the operand
+// both in B and at OPERAND_ADDRESS
+//
+
+const char *operationNames[] = {
+  "ADD", "ADC", "SUB", "SBC", "AND", "XOR", "OR", "CP", "INC r", "DEC r",
+  "INC (HL)", "DEC (HL)", "BIT", "SWAP r", "SWAP (HL)", "RLCA", "RLA",
+  "RRCA", "RRA", "RL r", "RL (HL)"
+};
+
+#define OPERATION_COUNT (int) (sizeof(operationNames) / sizeof(operationNames[0]))
+
+void runTable(int operation, uint8_t operand) {
+  switch (operation) {
+  case 0: ADD(operand); break;
+  case 1: ADC(operand); break;
+  case 2: SUB(operand); break;
+  case 3: SBC(operand); break;
+  case 4: AND(operand); break;
+  case 5: XOR(operand); break;
+  case 6: OR(operand); break;
+  case 7: CP(operand); break;
+  case 8: INC(REG_B); break;
+  case 9: DEC(REG_B); break;
+  case 10: INC_mem(OPERAND_ADDRESS); break;
+  case 11: DEC_mem(OPERAND_ADDRESS); break;
+  case 12: BIT(readReg(REG_A), operand); break;
+  case 13: SWAP(REG_B); break;
+  case 14: SWAP_mem(OPERAND_ADDRESS); break;
+  case 15: RLCA(); break;
+  case 16: RLA(); break;
+  case 17: RRCA(); break;
+  case 18: RRA(); break;
+  case 19: RL(REG_B); break;
+  case 20: RL_mem(OPERAND_ADDRESS); break;
+  }
+}
+
+void runReference(int operation, uint8_t operand) {
+  switch (operation) {
+  case 0: referenceADD(operand); break;
+  case 1: referenceADC(operand); break;
+  case 2: referenceSUB(operand); break;
+  case 3: referenceSBC(operand); break;
+  case 4: referenceLogic(readReg(REG_A) & operand, true); break;
+  case 5: referenceLogic(readReg(REG_A) ^ operand, false); break;
+  case 6: referenceLogic(readReg(REG_A) | operand, false); break;
+  case 7: referenceCP(operand); break;
+  case 8: writeReg(REG_B, referenceIncDec(operand, false)); break;
+  case 9: writeReg(REG_B, referenceIncDec(operand, true)); break;
+  case 10: writeMemory(OPERAND_ADDRESS, referenceIncDec(operand, false)); break;
+  case 11: writeMemory(OPERAND_ADDRESS, referenceIncDec(operand, true)); break;
+  case 12:
+    setFlag('Z', referenceBit(readReg(REG_A), operand));
+    setFlag('N', false);
+    setFlag('H', true);
+    break;
+  case 13: writeReg(REG_B, referenceSWAP(operand)); break;
+  case 14: writeMemory(OPERAND_ADDRESS, referenceSWAP(operand)); break;
+  case 15: writeReg(REG_A, referenceRotateLeft(readReg(REG_A), false, true)); break;
+  case 16: writeReg(REG_A, referenceRotateLeft(readReg(REG_A), true, true)); break;
+  case 17: writeReg(REG_A, referenceRotateRight(readReg(REG_A), false)); break;
+  case 18: writeReg(REG_A, referenceRotateRight(readReg(REG_A), true)); break;
+  case 19: writeReg(REG_B, referenceRotateLeft(operand, true, false)); break;
+  case 20: writeMemory(OPERAND_ADDRESS, referenceRotateLeft(operand, true, false)); break;
+  }
+}
+
+void setInputs(uint8_t a, uint8_t f, uint8_t operand) {
+  writeReg(REG_A, a);
+  writeReg(REG_F, f);
+  writeReg(REG_B, operand);
+  memory[OPERAND_ADDRESS] = operand;
+}
+
+uint32_t outputs() {
+  return readReg(REG_A) | readReg(REG_F) << 8 | readReg(REG_B) << 16 |
+    (uint32_t) memory[OPERAND_ADDRESS] << 24;
+}
+
+// Every combination through one implementation; the sum keeps the work
+// from being optimized out.
+double timeAll(void (*run)(int, uint8_t), int operation, uint32_t *sum) {
+  int a, f, operand;
+  double start = now();
+  for (f = 0; f < 0x100; f += 0x10) {
+    for (a = 0; a < 0x100; a++) {
+      for (operand = 0; operand < 0x100; operand++) {
+	setInputs(a, f, operand);
+	run(operation, operand);
+	*sum += outputs();
+      }
+    }
+  }
+  return now() - start;
+}
+
+int main() {
+  int operation, a, f, operand;
+  long failures = 0;
+  uint32_t sum = 0;
+
+  traceEnabled = false;
+  resetMachine();
+
+  printf("%-10s %10s %10s %9s\n", "", "reference", "tables", "");
+  for (operation = 0; operation < OPERATION_COUNT; operation++) {
+    long mismatches = 0;
+    for (f = 0; f < 0x100; f++) {
+      for (a = 0; a < 0x100; a++) {
+	for (operand = 0; operand < 0x100; operand++) {
+	  setInputs(a, f, operand);
+	  runTable(operation, operand);
+	  uint32_t expected, actual = outputs();
+	  setInputs(a, f, operand);
+	  runReference(operation, operand);
+	  expected = outputs();
+	  if (actual != expected && mismatches++ == 0) {
+	    printf("%s A=%02X F=%02X operand=%02X: got %08X, expected %08X\n",
+		   operationNames[operation], a, f, operand, actual, expected);
+	  }
+	}
+      }
+    }
+    failures += mismatches;
+
+    double referenceTime = timeAll(runReference, operation, &sum);
+    double tableTime = timeAll(runTable, operation, &sum);
+    printf("%-10s %8.2fns %8.2fns %9s\n", operationNames[operation],
+	   referenceTime / (16 << 16) * 1e9, tableTime / (16 << 16) * 1e9,
+	   mismatches ? "MISMATCH" : "ok");
+  }
+
+  printf("checksum %08X, %ld mismatches\n", sum, failures);
+  return failures ? 1 : 0;
+}
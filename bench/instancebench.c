@@ -0,0 +1,85 @@
+// Runs many instances of one ROM from a shared post-boot template and
+// reports what each actually owns, against a private copy of everything.
+// Every instance must end in the same state as a plain run.
+//
+//   cc -O2 -I.. -o instancebench instancebench.c ../instance.c ../boot.c ../capture.c ../cartridge.c ../cgb.c ../cheats.c ../cpu.c ../debugger.c ../dma.c ../flags.c ../interrupts.c ../joypad.c ../memory.c ../metrics.c ../pipeline.c ../ppu.c ../render.c ../savestate.c ../scheduler.c ../shm.c ../statehash.c ../timer.c ../until.c -lm -lrt -lpthread
+//   ./instancebench rom [instances] [frames]
+
+#include <time.h>
+#include "../boot.h"
+#include "../instance.h"
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    printf("usage: %s rom [instances] [frames]\n", argv[0]);
+    return 2;
+  }
+  int count = argc > 2 ? atoi(argv[2]) : 256;
+  int frames = argc > 3 ? atoi(argv[3]) : 60;
+  static machineState reference, state;
+  instanceTemplate template;
+  int i, frame;
+
+  traceEnabled = false;
+  if (!loadROM(argv[1])) {
+    return 2;
+  }
+
+  // the plain run every instance is checked against
+  fastBoot(MODEL_DMG);
+  for (frame = 0; frame < frames; frame++) {
+    runFrame();
+  }
+  saveState(&reference);
+
+  fastBoot(MODEL_DMG);
+  if (!createTemplate(&template)) {
+    return 2;
+  }
+  gbInstance *instances = calloc(count, sizeof(gbInstance));
+  int mismatches = 0;
+  size_t total = 0, most = 0;
+
+  double start = now();
+  for (i = 0; i < count; i++) {
+    if (!createInstance(&template, &instances[i])) {
+      return 2;
+    }
+    enterInstance(&instances[i]);
+    for (frame = 0; frame < frames; frame++) {
+      runFrame();
+    }
+    saveState(&state);
+    leaveInstance(&instances[i]);
+    if (memcmp(&state, &reference, sizeof(state)) != 0) {
+      mismatches++;
+    }
+  }
+  double elapsed = now() - start;
+
+  for (i = 0; i < count; i++) {
+    size_t resident = instanceResidentBytes(&instances[i]);
+    total += resident;
+    if (resident > most) {
+      most = resident;
+    }
+    freeInstance(&instances[i]);
+  }
+  freeTemplate(&template);
+
+  printf("instances: %d, frames each: %d, %.0f instance frames/sec\n", count, frames,
+	 count * frames / elapsed);
+  printf("arena:       %zu bytes per instance if copied\n", template.size);
+  printf("resident:    %zu bytes per instance on average, %zu at most\n", total / count, most);
+  printf("total:       %zu bytes plus the %zu byte template, vs %zu copied\n", total, template.size,
+	 template.size * count);
+  printf("%d instances differ from the plain run\n", mismatches);
+  free(instances);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+// Compares aggregate instructions/sec of the lockstep core against the same
+// number of independent scalar instances, and checks both end in the same
+// state.
+//
+//   cc -O2 -mavx2 -I.. -o lockstepbench lockstepbench.c ../lockstep.c ../capture.c ../cpu.c ../memory.c ../metrics.c ../cartridge.c ../cgb.c ../cheats.c ../debugger.c ../dma.c ../flags.c ../interrupts.c ../joypad.c ../pipeline.c ../ppu.c ../render.c ../scheduler.c ../shm.c ../statehash.c ../timer.c ../until.c -lm -lrt -lpthread
+//   ./lockstepbench [lanes] [steps] [stagger]
+//
+// With stagger set, lane n first runs n instructions on its own so the lanes
+// never share a pc; that measures the divergent worst case.
+
+#include <time.h>
+#include "../lockstep.h"
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, const char* argv[]) {
+  int lanes = argc > 1 ? atoi(argv[1]) : LOCKSTEP_LANES;
+  long steps = argc > 2 ? atol(argv[2]) : 50000;
+  bool stagger = argc > 3 && atoi(argv[3]);
+  int lane;
+  long i;
+
+  traceEnabled = false;
+
+  // independent scalar instances, each with its own address space
+  cpuState scalarStates[LOCKSTEP_LANES];
+  uint64_t scalarCycles[LOCKSTEP_LANES];
+  uint8_t *scalarImages[LOCKSTEP_LANES];
+  cpuState state;
+  memset(&state, 0, sizeof(state));
+  loadCPUState(&state);
+
+  double start = now();
+  for (lane = 0; lane < lanes; lane++) {
+    scalarImages[lane] = calloc(MEMORY_SIZE, 1);
+    setMemoryImage(scalarImages[lane]);
+    initializeMemory();
+    memset(&state, 0, sizeof(state));
+    loadCPUState(&state);
+    initializeCPU();
+    cycles = 0;
+    for (i = 0; i < steps + (stagger ? lane : 0); i++) {
+      executeOpcode(readNextByte());
+    }
+    saveCPUState(&scalarStates[lane]);
+    scalarCycles[lane] = cycles;
+  }
+  double scalarTime = now() - start;
+
+  lockstepCore core;
+  initializeLockstep(&core, lanes);
+  if (stagger) {
+    for (lane = 0; lane < lanes; lane++) {
+      for (i = 0; i < lane; i++) {
+	stepLane(&core, lane);
+      }
+    }
+    core.scalarSteps = 0;
+  }
+
+  start = now();
+  for (i = 0; i < steps; i++) {
+    stepLockstep(&core);
+  }
+  double lockstepTime = now() - start;
+
+  int mismatches = 0;
+  for (lane = 0; lane < lanes; lane++) {
+    storeLane(&core, lane, &state);
+    if (memcmp(&state, &scalarStates[lane], sizeof(state)) != 0 ||
+	core.cycles[lane] != scalarCycles[lane] ||
+	memcmp(core.memory[lane], scalarImages[lane], MEMORY_SIZE) != 0) {
+      printf("lane %d: state differs from scalar run\n", lane);
+      mismatches++;
+    }
+    free(scalarImages[lane]);
+  }
+
+  double total = (double) lanes * steps;
+  printf("lanes: %d, steps: %ld, stagger: %s\n", lanes, steps, stagger ? "yes" : "no");
+  if (core.faulted) {
+    printf("%d lanes faulted on something lanes cannot run alone\n", __builtin_popcount(core.faulted));
+  }
+  printf("scalar:   %.2f M instructions/sec\n", total / scalarTime / 1e6);
+  printf("lockstep: %.2f M instructions/sec (%.1f%% vector)\n", total / lockstepTime / 1e6,
+	 100.0 * core.vectorSteps / (core.vectorSteps + core.scalarSteps));
+
+  freeLockstep(&core);
+  return mismatches ? 1 : 0;
+}
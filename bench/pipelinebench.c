@@ -0,0 +1,120 @@
+// Frames/sec with lines composed on the emulation thread and on the render
+// thread, and a check that the pipelined framebuffer matches the synchronous
+// one after every frame. The program keeps rewriting tile data, SCX and OAM
+// so the render thread has to replay the journal mid-frame.
+//
+//   cc -O2 -I.. -o pipelinebench pipelinebench.c ../boot.c ../capture.c ../cartridge.c ../cgb.c ../cheats.c ../cpu.c ../debugger.c ../dma.c ../flags.c ../interrupts.c ../joypad.c ../memory.c ../metrics.c ../pipeline.c ../ppu.c ../render.c ../savestate.c ../scheduler.c ../shm.c ../statehash.c ../timer.c ../until.c -lm -lrt -lpthread
+//   ./pipelinebench [frames]
+//
+// The speedup needs a second core; on one it only shows the overhead.
+
+#include <time.h>
+#include "../boot.h"
+#include "../cpu.h"
+#include "../ppu.h"
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Fill 0x8000-0x97FF with B, B+1, ..., storing SCX after every 256 bytes,
+// then the same into OAM, forever. Absolute operands are high byte first.
+const uint8_t program[] = {
+  0x21, 0x80, 0x00,       // 0100 LD HL,0x8000
+  0x78,                   // 0103 LD A,B
+  0x77,                   // 0104 LD (HL),A
+  0x04,                   // 0105 INC B
+  0x2C,                   // 0106 INC L
+  0xC2, 0x01, 0x03,       // 0107 JP NZ,0x0103
+  0xEA, 0xFF, 0x43,       // 010A LD (0xFF43),A
+  0x24,                   // 010D INC H
+  0x7C,                   // 010E LD A,H
+  0xFE, 0x98,             // 010F CP 0x98
+  0xC2, 0x01, 0x03,       // 0111 JP NZ,0x0103
+  0x21, 0xFE, 0x00,       // 0114 LD HL,0xFE00
+  0x78,                   // 0117 LD A,B
+  0x77,                   // 0118 LD (HL),A
+  0x04,                   // 0119 INC B
+  0x2C,                   // 011A INC L
+  0x7D,                   // 011B LD A,L
+  0xFE, 0xA0,             // 011C CP 0xA0
+  0xC2, 0x01, 0x17,       // 011E JP NZ,0x0117
+  0xC3, 0x01, 0x00,       // 0121 JP 0x0100
+};
+
+// Background, window and sprites on, as in ppubench.
+void setupScreen() {
+  int i;
+
+  for (i = 0x8000; i < 0x9800; i++) {
+    memory[i] = i * 37;
+  }
+  for (i = 0x9800; i < 0xA000; i++) {
+    memory[i] = i;
+  }
+  for (i = 0; i < 40; i++) {
+    memory[0xFE00 + i * 4] = 16 + i * 4;
+    memory[0xFE00 + i * 4 + 1] = 8 + i * 4;
+    memory[0xFE00 + i * 4 + 2] = i;
+    memory[0xFE00 + i * 4 + 3] = (i & 7) << 4;
+  }
+  memory[0xFF4A] = 72;
+  memory[0xFF4B] = 87;
+  writeMemory(0xFF40, 0xF3);
+  memcpy(memory + 0x0100, program, sizeof(program));
+}
+
+uint64_t hashFramebuffer() {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  int i;
+  for (i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+    hash = (hash ^ framebuffer[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+int main(int argc, const char* argv[]) {
+  long frames = argc > 1 ? atol(argv[1]) : 5000;
+  uint64_t *hashes = malloc(frames * sizeof(uint64_t));
+  long mismatches = 0;
+  long i;
+
+  traceEnabled = false;
+
+  fastBoot(MODEL_DMG);
+  setupScreen();
+  double start = now();
+  for (i = 0; i < frames; i++) {
+    runFrame();
+    hashes[i] = hashFramebuffer();
+  }
+  double syncTime = now() - start;
+
+  fastBoot(MODEL_DMG);
+  setupScreen();
+  start = now();
+  startPipeline();
+  for (i = 0; i < frames; i++) {
+    runFrame();
+    // the framebuffer now holds the frame before
+    if (i > 0 && hashFramebuffer() != hashes[i - 1]) {
+      mismatches++;
+    }
+  }
+  stopPipeline();
+  double pipelineTime = now() - start;
+  if (hashFramebuffer() != hashes[frames - 1]) {
+    mismatches++;
+  }
+
+  printf("frames: %ld, %llu lines drawn, %llu writes journalled\n", frames,
+	 (unsigned long long) pipeline.lines, (unsigned long long) pipeline.journalled);
+  printf("synchronous: %8.0f frames/sec\n", frames / syncTime);
+  printf("pipelined:   %8.0f frames/sec, waited on the render thread %llu times (%.1f ms)\n",
+	 frames / pipelineTime, (unsigned long long) pipeline.waits, pipeline.waitNanoseconds / 1e6);
+  printf("%ld frames differ\n", mismatches);
+  free(hashes);
+  return mismatches ? 1 : 0;
+}
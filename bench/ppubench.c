@@ -0,0 +1,74 @@
+// Frames/sec with every frame rendered, one in four, and none, to show what
+// skipped frames cost. The CPU sits in HALT so nearly all the time is PPU
+// work: the mode/line events, plus composition on rendered frames.
+//
+//   cc -O2 -I.. -o ppubench ppubench.c ../boot.c ../capture.c ../cartridge.c ../cgb.c ../cheats.c ../cpu.c ../debugger.c ../dma.c ../flags.c ../interrupts.c ../joypad.c ../memory.c ../metrics.c ../pipeline.c ../ppu.c ../render.c ../savestate.c ../scheduler.c ../shm.c ../statehash.c ../timer.c ../until.c -lm -lrt -lpthread
+//   ./ppubench [frames]
+
+#include <time.h>
+#include "../boot.h"
+#include "../cpu.h"
+#include "../ppu.h"
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A screen with background, window and a full set of sprites, so rendered
+// frames take every composition path.
+void setupScreen() {
+  int i;
+
+  for (i = 0x8000; i < 0x9800; i++) {
+    memory[i] = i * 37;
+  }
+  for (i = 0x9800; i < 0xA000; i++) {
+    memory[i] = i;
+  }
+  for (i = 0; i < 40; i++) {
+    memory[0xFE00 + i * 4] = 16 + i * 4;
+    memory[0xFE00 + i * 4 + 1] = 8 + i * 4;
+    memory[0xFE00 + i * 4 + 2] = i;
+    memory[0xFE00 + i * 4 + 3] = (i & 7) << 4;
+  }
+  memory[0xFF4A] = 72;
+  memory[0xFF4B] = 87;
+  writeMemory(0xFF40, 0xF3); // LCD, window, sprites, background on
+  memory[0x0100] = 0x76; // HALT
+}
+
+double measure(int skip, long frames) {
+  long i;
+
+  frameSkip = skip;
+  fastBoot(MODEL_DMG);
+  setupScreen();
+
+  double start = now();
+  for (i = 0; i < frames; i++) {
+    runFrame();
+  }
+  double elapsed = now() - start;
+
+  if (skip == FRAME_SKIP_ALL) {
+    printf("skip all");
+  }
+  else {
+    printf("skip %-3d", skip);
+  }
+  printf(" %8.0f frames/sec, %llu of %llu frames rendered\n", frames / elapsed,
+	 (unsigned long long) ppu.renderedFrames, (unsigned long long) ppu.frames);
+  return elapsed;
+}
+
+int main(int argc, const char* argv[]) {
+  long frames = argc > 1 ? atol(argv[1]) : 20000;
+
+  traceEnabled = false;
+  measure(0, frames);
+  measure(3, frames);
+  measure(FRAME_SKIP_ALL, frames);
+  return 0;
+}
@@ -0,0 +1,335 @@
+// Replays recorded movies against their ROMs and reports frames/sec,
+// instructions/sec and peak RSS per title, optionally checked against a
+// baseline from an earlier build.
+//
+//   cc -O2 -I.. -o replaybench replaybench.c ../boot.c ../capture.c ../cartridge.c ../cgb.c ../cheats.c ../cpu.c ../debugger.c ../dma.c ../flags.c ../interrupts.c ../joypad.c ../memory.c ../metrics.c ../movie.c ../pipeline.c ../ppu.c ../render.c ../savestate.c ../scheduler.c ../shm.c ../statehash.c ../timer.c ../until.c -lm -lrt -lpthread
+//   ./replaybench corpus [--runs n] [--output file] [--baseline file [--tolerance percent]]
+//
+// The corpus lists one title per line as "title rom movie"; blank lines and
+// lines starting with # are skipped. Each title runs in its own process,
+// from the post-boot state the movie's first keyframe restores, so its RSS
+// is its own. Speeds are the median of the runs, which keeps the numbers
+// steady enough to track from build to build. The results are written as
+// JSON, one title per line; with a baseline in the same format, a title
+// that got slower or bigger by more than the tolerance fails the run.
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "../boot.h"
+#include "../cpu.h"
+#include "../movie.h"
+
+#define MAX_TITLES 256
+#define MAX_RUNS 15
+#define NAME_LENGTH 64
+#define PATH_LENGTH 256
+#define RSS_SLACK_KB 512 // allocator noise, peak RSS moves this much run to run
+
+typedef struct {
+  char title[NAME_LENGTH];
+  char rom[PATH_LENGTH];
+  char movie[PATH_LENGTH];
+} corpusEntry;
+
+typedef struct {
+  char title[NAME_LENGTH];
+  bool ok;
+  uint64_t frames;
+  double framesPerSecond;
+  double instructionsPerSecond;
+  long peakKilobytes;
+} replayResult;
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+int readCorpus(const char *path, corpusEntry *entries) {
+  FILE *file = fopen(path, "r");
+  char line[1024];
+  int count = 0;
+
+  if (file == NULL) {
+    printf("Error: could not open corpus %s\n", path);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), file) != NULL && count < MAX_TITLES) {
+    corpusEntry *entry = &entries[count];
+    if (line[0] == '#' || sscanf(line, "%63s %255s %255s", entry->title, entry->rom, entry->movie) != 3) {
+      continue;
+    }
+    count++;
+  }
+  fclose(file);
+  return count;
+}
+
+// Child side: play the movie through runs times and send back the medians.
+void replayTitle(const corpusEntry *entry, int runs, int output) {
+  replayResult result;
+  double frameRates[MAX_RUNS], instructionRates[MAX_RUNS];
+  int run;
+
+  memset(&result, 0, sizeof(result));
+  strcpy(result.title, entry->title);
+  traceEnabled = false;
+  if (!loadROM(entry->rom)) {
+    goto done;
+  }
+  for (run = 0; run < runs; run++) {
+    fastBoot(MODEL_DMG);
+    if (!startPlayback(entry->movie)) {
+      goto done;
+    }
+    uint64_t frames = 0;
+    uint64_t instructions = metrics.instructions;
+    double start = now();
+    while (playMovieFrame()) {
+      frames++;
+    }
+    double elapsed = now() - start;
+    stopPlayback();
+
+    result.frames = frames;
+    frameRates[run] = frames / elapsed;
+    instructionRates[run] = (metrics.instructions - instructions) / elapsed;
+  }
+  qsort(frameRates, runs, sizeof(double), compareDoubles);
+  qsort(instructionRates, runs, sizeof(double), compareDoubles);
+  result.framesPerSecond = frameRates[runs / 2];
+  result.instructionsPerSecond = instructionRates[runs / 2];
+  result.ok = result.frames > 0;
+
+done:
+  if (write(output, &result, sizeof(result)) != sizeof(result)) {
+    exit(1);
+  }
+  exit(0);
+}
+
+bool runTitle(const corpusEntry *entry, int runs, replayResult *result) {
+  int channel[2];
+  struct rusage usage;
+  int status;
+
+  fflush(stdout);
+  if (pipe(channel) != 0) {
+    return false;
+  }
+  pid_t child = fork();
+  if (child == 0) {
+    close(channel[0]);
+    replayTitle(entry, runs, channel[1]);
+  }
+  close(channel[1]);
+  bool ok = child > 0 && read(channel[0], result, sizeof(*result)) == sizeof(*result);
+  close(channel[0]);
+  if (child > 0 && wait4(child, &status, 0, &usage) == child) {
+    result->peakKilobytes = usage.ru_maxrss;
+  }
+  return ok && result->ok;
+}
+
+// Titles come from the corpus as-is, so quotes, backslashes and control
+// bytes in them are escaped.
+void writeString(FILE *file, const char *text) {
+  fputc('"', file);
+  for (; *text; text++) {
+    if (*text == '"' || *text == '\\') {
+      fprintf(file, "\\%c", *text);
+    }
+    else if ((unsigned char) *text < 0x20) {
+      fprintf(file, "\\u%04x", (unsigned char) *text);
+    }
+    else {
+      fputc(*text, file);
+    }
+  }
+  fputc('"', file);
+}
+
+void writeResults(FILE *file, const replayResult *results, int count) {
+  int i;
+  fprintf(file, "[\n");
+  for (i = 0; i < count; i++) {
+    fprintf(file, "  {\"title\": ");
+    writeString(file, results[i].title);
+    fprintf(file, ", \"frames\": %llu, \"fps\": %.1f, \"ips\": %.0f, \"rss_kb\": %ld}%s\n",
+	    (unsigned long long) results[i].frames, results[i].framesPerSecond,
+	    results[i].instructionsPerSecond, results[i].peakKilobytes, i + 1 < count ? "," : "");
+  }
+  fprintf(file, "]\n");
+}
+
+// Undo writeString on the string text starts with. Returns what follows the
+// closing quote, or NULL if it is malformed or longer than NAME_LENGTH - 1.
+const char *readString(const char *text, char *out) {
+  int length = 0;
+  unsigned code;
+
+  if (*text++ != '"') {
+    return NULL;
+  }
+  while (*text != '"') {
+    if (*text == '\0' || length == NAME_LENGTH - 1) {
+      return NULL;
+    }
+    if (*text != '\\') {
+      out[length++] = *text++;
+    }
+    else if (text[1] == 'u' && sscanf(text + 2, "%4x", &code) == 1 && code < 0x100) {
+      out[length++] = code;
+      text += 6;
+    }
+    else if (text[1] == '"' || text[1] == '\\') {
+      out[length++] = text[1];
+      text += 2;
+    }
+    else {
+      return NULL;
+    }
+  }
+  out[length] = '\0';
+  return text + 1;
+}
+
+// Reads back what writeResults wrote.
+int readResults(const char *path, replayResult *results) {
+  FILE *file = fopen(path, "r");
+  char line[1024];
+  int count = 0;
+
+  if (file == NULL) {
+    printf("Error: could not open baseline %s\n", path);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), file) != NULL && count < MAX_TITLES) {
+    replayResult *result = &results[count];
+    unsigned long long frames;
+    const char *title = strstr(line, "{\"title\": ");
+    const char *rest = title ? readString(title + 10, result->title) : NULL;
+    if (rest != NULL &&
+	sscanf(rest, ", \"frames\": %llu, \"fps\": %lf, \"ips\": %lf, \"rss_kb\": %ld}",
+	       &frames, &result->framesPerSecond, &result->instructionsPerSecond,
+	       &result->peakKilobytes) == 4) {
+      result->frames = frames;
+      count++;
+    }
+  }
+  fclose(file);
+  return count;
+}
+
+// Prints each regression and returns how many there were.
+int compareResults(const replayResult *results, int count, const replayResult *baseline,
+		   int baselineCount, double tolerance) {
+  int regressions = 0;
+  int i, j;
+
+  for (i = 0; i < count; i++) {
+    const replayResult *now = &results[i];
+    for (j = 0; j < baselineCount && strcmp(baseline[j].title, now->title) != 0; j++) {
+    }
+    if (j == baselineCount) {
+      printf("%s: not in the baseline\n", now->title);
+      continue;
+    }
+    const replayResult *then = &baseline[j];
+    if (now->framesPerSecond < then->framesPerSecond * (1 - tolerance)) {
+      printf("%s: REGRESSION fps %.1f, baseline %.1f\n", now->title, now->framesPerSecond, then->framesPerSecond);
+      regressions++;
+    }
+    if (now->instructionsPerSecond < then->instructionsPerSecond * (1 - tolerance)) {
+      printf("%s: REGRESSION ips %.0f, baseline %.0f\n", now->title, now->instructionsPerSecond,
+	     then->instructionsPerSecond);
+      regressions++;
+    }
+    if (now->peakKilobytes > then->peakKilobytes * (1 + tolerance) + RSS_SLACK_KB) {
+      printf("%s: REGRESSION rss %ld kB, baseline %ld kB\n", now->title, now->peakKilobytes, then->peakKilobytes);
+      regressions++;
+    }
+    if (now->frames != then->frames) {
+      printf("%s: played %llu frames, baseline %llu\n", now->title,
+	     (unsigned long long) now->frames, (unsigned long long) then->frames);
+    }
+  }
+  return regressions;
+}
+
+int main(int argc, const char* argv[]) {
+  static corpusEntry entries[MAX_TITLES];
+  static replayResult results[MAX_TITLES], baseline[MAX_TITLES];
+  const char *corpusPath = NULL;
+  const char *outputPath = NULL;
+  const char *baselinePath = NULL;
+  double tolerance = 0.05;
+  int runs = 3;
+  int count, i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      outputPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+      baselinePath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+      tolerance = atof(argv[++i]) / 100;
+    }
+    else if (argv[i][0] != '-' && corpusPath == NULL) {
+      corpusPath = argv[i];
+    }
+    else {
+      corpusPath = NULL;
+      break;
+    }
+  }
+  if (corpusPath == NULL || runs < 1 || runs > MAX_RUNS) {
+    printf("usage: %s corpus [--runs n] [--output file] [--baseline file [--tolerance percent]]\n", argv[0]);
+    return 2;
+  }
+
+  count = readCorpus(corpusPath, entries);
+  if (count < 0) {
+    return 2;
+  }
+  int failures = 0;
+  for (i = 0; i < count; i++) {
+    if (!runTitle(&entries[i], runs, &results[i])) {
+      printf("%s: replay failed\n", entries[i].title);
+      failures++;
+    }
+  }
+
+  writeResults(stdout, results, count);
+  if (outputPath != NULL) {
+    FILE *file = fopen(outputPath, "w");
+    if (file == NULL) {
+      printf("Error: could not write %s\n", outputPath);
+      return 2;
+    }
+    writeResults(file, results, count);
+    fclose(file);
+  }
+
+  if (baselinePath != NULL) {
+    int baselineCount = readResults(baselinePath, baseline);
+    if (baselineCount < 0) {
+      return 2;
+    }
+    failures += compareResults(results, count, baseline, baselineCount, tolerance);
+  }
+  return failures ? 1 : 0;
+}
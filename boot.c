@@ -0,0 +1,212 @@
+#include "boot.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "dma.h"
+#include "interrupts.h"
+#include "joypad.h"
+#include "ppu.h"
+#include "savestate.h"
+#include "timer.h"
+
+// I/O registers as the boot ROM leaves them, DIV and P1 are set separately
+typedef struct {
+  uint16_t address;
+  uint8_t value;
+} ioDefault;
+
+const ioDefault postBootIO[] = {
+  { 0xFF01, 0x00 }, { 0xFF02, 0x7E }, { 0xFF05, 0x00 }, { 0xFF06, 0x00 },
+  { 0xFF07, 0xF8 }, { 0xFF0F, 0xE1 }, { 0xFF10, 0x80 }, { 0xFF11, 0xBF },
+  { 0xFF12, 0xF3 }, { 0xFF13, 0xFF }, { 0xFF14, 0xBF }, { 0xFF16, 0x3F },
+  { 0xFF17, 0x00 }, { 0xFF18, 0xFF }, { 0xFF19, 0xBF }, { 0xFF1A, 0x7F },
+  { 0xFF1B, 0xFF }, { 0xFF1C, 0x9F }, { 0xFF1D, 0xFF }, { 0xFF1E, 0xBF },
+  { 0xFF20, 0xFF }, { 0xFF21, 0x00 }, { 0xFF22, 0x00 }, { 0xFF23, 0xBF },
+  { 0xFF24, 0x77 }, { 0xFF25, 0xF3 }, { 0xFF26, 0xF1 }, { 0xFF40, 0x91 },
+  { 0xFF41, 0x85 }, { 0xFF42, 0x00 }, { 0xFF43, 0x00 }, { 0xFF44, 0x00 },
+  { 0xFF45, 0x00 }, { 0xFF46, 0xFF }, { 0xFF47, 0xFC }, { 0xFF48, 0xFF },
+  { 0xFF49, 0xFF }, { 0xFF4A, 0x00 }, { 0xFF4B, 0x00 }, { 0xFFFF, 0x00 }
+};
+
+const ioDefault postBootCGB[] = {
+  { 0xFF4D, 0x7E }, { 0xFF4F, 0xFE }, { 0xFF51, 0xFF }, { 0xFF52, 0xFF },
+  { 0xFF53, 0xFF }, { 0xFF54, 0xFF }, { 0xFF55, 0xFF }, { 0xFF70, 0xF8 }
+};
+
+// Power-on state: cartridge mapped, boot ROM on top, everything else clear.
+void resetMachine() {
+  cpuState state;
+
+  memset(memory, 0, MEMORY_SIZE);
+  mapROM();
+  initializeMemory();
+
+  memset(&state, 0, sizeof(state));
+  loadCPUState(&state);
+  initializeCPU();
+  cycles = 0;
+  frameCount = 0;
+
+  initializeScheduler();
+  initializePPU();
+  initializeJoypad();
+  initializeTimer();
+  initializeInterrupts();
+  initializeDMA();
+  initializeCGB();
+}
+
+// Stretch each bit of a nibble to two pixels, as the boot ROM does when it
+// copies the cartridge logo into VRAM.
+uint8_t doubleNibble(uint8_t nibble) {
+  uint8_t result = 0;
+  int bit;
+  for (bit = 0; bit < 4; bit++) {
+    if (nibble & (1 << bit)) {
+      result |= 3 << (bit * 2);
+    }
+  }
+  return result;
+}
+
+// The DMG boot ROM leaves the scaled-up logo from the cartridge header in
+// tiles 1-24, the (R) tile in 25, and a tile map row pointing at them.
+void loadBootLogo() {
+  uint16_t address = 0x8010;
+  int i, row;
+
+  for (i = 0; i < 48; i++) {
+    uint8_t logo = memory[0x0104 + i];
+    uint8_t nibbles[2] = { logo >> 4, logo & 0x0F };
+    for (row = 0; row < 4; row++) {
+      memory[address] = doubleNibble(nibbles[row / 2]);
+      address += 2;
+    }
+  }
+  for (i = 0; i < 8; i++) {
+    memory[address] = bios[0xD8 + i];
+    address += 2;
+  }
+
+  for (i = 0; i < 12; i++) {
+    memory[0x9904 + i] = i + 1;
+    memory[0x9924 + i] = i + 13;
+  }
+  memory[0x9910] = 0x19;
+}
+
+// Put the machine where the boot ROM would leave it, without running it.
+void fastBoot(bootModel model) {
+  size_t i;
+
+  cgbMode = model == MODEL_CGB;
+  resetMachine();
+
+  // unmap the boot ROM the same way the boot ROM itself does
+  writeMemory(0xFF50, 0x01);
+
+  if (model == MODEL_CGB) {
+    writeReg(REG_AF, 0x1180);
+    writeReg(REG_BC, 0x0000);
+    writeReg(REG_DE, 0xFF56);
+    writeReg(REG_HL, 0x000D);
+  }
+  else {
+    writeReg(REG_AF, 0x01B0);
+    writeReg(REG_BC, 0x0013);
+    writeReg(REG_DE, 0x00D8);
+    writeReg(REG_HL, 0x014D);
+    loadBootLogo();
+  }
+  sp = 0xFFFE;
+  pc = 0x0100;
+  interruptsEnabled = false;
+
+  for (i = 0; i < sizeof(postBootIO) / sizeof(postBootIO[0]); i++) {
+    memory[postBootIO[i].address] = postBootIO[i].value;
+  }
+  if (model == MODEL_CGB) {
+    for (i = 0; i < sizeof(postBootCGB) / sizeof(postBootCGB[0]); i++) {
+      memory[postBootCGB[i].address] = postBootCGB[i].value;
+    }
+  }
+
+  initializePPU(); // LCDC is on now
+  writeJoypad(0x30);
+  timer.divBase = cycles - 0xAB00; // DIV reads 0xAB
+  timer.timaBase = cycles;
+  timer.timaValue = 0;
+  scheduleTimer();
+  updateInterrupts();
+}
+
+machineState fastBootState;
+machineState realBootState;
+
+// Run the real boot ROM and compare registers, I/O and VRAM with what
+// fastBoot produces. The fast boot state is left loaded either way. Only
+// the DMG boot ROM is built in, so only MODEL_DMG can be checked, and the
+// check gives up if the boot ROM reaches an opcode the CPU lacks.
+bool verifyBoot(bootModel model) {
+  bool match = true;
+  uint16_t opcodeAddress = 0;
+  int i;
+
+  if (model != MODEL_DMG) {
+    printf("Error: only the DMG boot can be checked\n");
+    return false;
+  }
+
+  fastBoot(model);
+  saveState(&fastBootState);
+
+  resetMachine();
+  stopOnUnimplemented = true;
+  unimplementedOpcode = -1;
+  while (pc != 0x0100 && cycles < BOOT_CYCLE_LIMIT && unimplementedOpcode < 0) {
+    opcodeAddress = pc;
+    step();
+  }
+  stopOnUnimplemented = false;
+  saveState(&realBootState);
+  loadState(&fastBootState);
+
+  if (unimplementedOpcode >= 0) {
+    printf("Boot check: boot ROM reached unimplemented %sopcode 0x%02X at 0x%04X\n",
+	   unimplementedOpcode & 0x100 ? "extended " : "", unimplementedOpcode & 0xFF, opcodeAddress);
+    return false;
+  }
+  if (realBootState.cpu.pc != 0x0100) {
+    printf("Boot check: boot ROM did not reach 0x0100 within %d cycles\n", BOOT_CYCLE_LIMIT);
+    return false;
+  }
+
+  for (i = 0; i < 8; i++) {
+    if (i != REG_F && realBootState.cpu.registers[i] != fastBootState.cpu.registers[i]) {
+      printf("Boot check: register %d is 0x%02X, fast boot has 0x%02X\n", i,
+	     realBootState.cpu.registers[i], fastBootState.cpu.registers[i]);
+      match = false;
+    }
+  }
+  if (realBootState.cpu.sp != fastBootState.cpu.sp) {
+    printf("Boot check: sp is 0x%04X, fast boot has 0x%04X\n",
+	   realBootState.cpu.sp, fastBootState.cpu.sp);
+    match = false;
+  }
+  for (i = 0; i < (int) (sizeof(postBootIO) / sizeof(postBootIO[0])); i++) {
+    uint16_t address = postBootIO[i].address;
+    if (realBootState.memory[address] != fastBootState.memory[address]) {
+      printf("Boot check: 0x%04X is 0x%02X, fast boot has 0x%02X\n", address,
+	     realBootState.memory[address], fastBootState.memory[address]);
+      match = false;
+    }
+  }
+  for (i = 0x8000; i < 0xA000; i++) {
+    if (realBootState.memory[i] != fastBootState.memory[i]) {
+      printf("Boot check: VRAM differs from 0x%04X\n", i);
+      match = false;
+      break;
+    }
+  }
+
+  return match;
+}
@@ -0,0 +1,15 @@
+#ifndef BOOT_H_INCLUDED
+#define BOOT_H_INCLUDED
+
+#include <stdbool.h>
+
+typedef enum { MODEL_DMG, MODEL_CGB } bootModel;
+
+// give up on the real boot ROM after this many cycles
+#define BOOT_CYCLE_LIMIT (100 * CYCLES_PER_FRAME)
+
+void resetMachine(void);
+void fastBoot(bootModel);
+bool verifyBoot(bootModel);
+
+#endif
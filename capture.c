@@ -0,0 +1,361 @@
+#define _GNU_SOURCE // O_DIRECT
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "capture.h"
+#include "cpu.h"
+#include "metrics.h"
+#include "ppu.h"
+
+// Capture runs in two halves. The emulation thread copies each frame or
+// audio block into one of CAPTURE_SLOTS preallocated slots and moves on;
+// only when every slot is still waiting to be written does it block, and
+// that is counted as a stall. A writer thread drains the slots in order into
+// a per-stream staging buffer and writes it out CAPTURE_WRITE_SIZE bytes at
+// a time. With direct set the files are opened O_DIRECT where the
+// filesystem allows it; the staging buffers are aligned for that, and the
+// unaligned tail is written after O_DIRECT is turned off again.
+
+#define Y4M_FRAME_HEADER "FRAME\n"
+#define Y4M_FRAME_SIZE (sizeof(Y4M_FRAME_HEADER) - 1 + SCREEN_WIDTH * SCREEN_HEIGHT * 3 / 2)
+#define WAV_HEADER_SIZE 44
+#define CPU_CLOCK 4194304
+
+typedef enum { STREAM_VIDEO, STREAM_AUDIO, STREAM_COUNT } captureStream;
+
+typedef struct {
+  captureStream stream;
+  uint32_t length;
+  uint8_t *data;
+} captureSlot;
+
+typedef struct {
+  int fd;
+  uint8_t *staging;
+  uint32_t staged;
+  uint64_t written;
+} captureFile;
+
+captureStats capture;
+
+bool capturing = false;
+bool writerStopping;
+bool writeFailed;
+pthread_t writerThread;
+pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t queueReady = PTHREAD_COND_INITIALIZER;
+pthread_cond_t slotFree = PTHREAD_COND_INITIALIZER;
+
+captureSlot slots[CAPTURE_SLOTS];
+uint32_t queueHead, queueTail, queued;
+captureFile files[STREAM_COUNT];
+uint64_t audioCycle;
+
+// DMG shades 0-3 as luma, lightest first
+const uint8_t shadeLuma[4] = { 255, 170, 85, 0 };
+
+uint64_t nanoseconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool writeAll(int fd, const uint8_t *data, size_t length) {
+  while (length > 0) {
+    ssize_t count = write(fd, data, length);
+    if (count < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return false;
+    }
+    data += count;
+    length -= count;
+    capture.bytesWritten += count;
+  }
+  capture.writes++;
+  return true;
+}
+
+// Writer thread side: append to the staging buffer, writing it out each
+// time it fills.
+void stageData(captureFile *file, const uint8_t *data, uint32_t length) {
+  while (length > 0) {
+    uint32_t count = CAPTURE_WRITE_SIZE - file->staged;
+    if (count > length) {
+      count = length;
+    }
+    memcpy(file->staging + file->staged, data, count);
+    file->staged += count;
+    file->written += count;
+    data += count;
+    length -= count;
+
+    if (file->staged == CAPTURE_WRITE_SIZE) {
+      if (!writeFailed && !writeAll(file->fd, file->staging, CAPTURE_WRITE_SIZE)) {
+	printf("Error: capture write failed\n");
+	writeFailed = true;
+      }
+      file->staged = 0;
+    }
+  }
+}
+
+void *writerMain(void *unused) {
+  (void) unused;
+  registerMetrics();
+  pthread_mutex_lock(&queueLock);
+  for (;;) {
+    while (queued == 0 && !writerStopping) {
+      pthread_cond_wait(&queueReady, &queueLock);
+    }
+    if (queued == 0) {
+      break;
+    }
+    captureSlot *slot = &slots[queueHead];
+    pthread_mutex_unlock(&queueLock);
+
+    stageData(&files[slot->stream], slot->data, slot->length);
+
+    pthread_mutex_lock(&queueLock);
+    queueHead = (queueHead + 1) % CAPTURE_SLOTS;
+    queued--;
+    pthread_cond_signal(&slotFree);
+  }
+  pthread_mutex_unlock(&queueLock);
+  unregisterMetrics();
+  return NULL;
+}
+
+// Emulation thread side: the slot at the tail, waiting for one to free up
+// if the writer has fallen behind.
+captureSlot *acquireSlot() {
+  pthread_mutex_lock(&queueLock);
+  if (queued == CAPTURE_SLOTS) {
+    uint64_t start = nanoseconds();
+    capture.stalls++;
+    while (queued == CAPTURE_SLOTS) {
+      pthread_cond_wait(&slotFree, &queueLock);
+    }
+    capture.stallNanoseconds += nanoseconds() - start;
+  }
+  pthread_mutex_unlock(&queueLock);
+  return &slots[queueTail];
+}
+
+void submitSlot() {
+  pthread_mutex_lock(&queueLock);
+  queueTail = (queueTail + 1) % CAPTURE_SLOTS;
+  queued++;
+  if (queued > capture.maxQueued) {
+    capture.maxQueued = queued;
+  }
+  pthread_cond_signal(&queueReady);
+  pthread_mutex_unlock(&queueLock);
+}
+
+void writeWAVHeader(uint8_t *header, uint32_t dataSize) {
+  uint32_t byteRate = AUDIO_RATE * AUDIO_CHANNELS * 2;
+  uint32_t value;
+
+  memcpy(header, "RIFF", 4);
+  value = 36 + dataSize;
+  memcpy(header + 4, &value, 4);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  value = 16;
+  memcpy(header + 16, &value, 4);
+  header[20] = 1; // PCM
+  header[21] = 0;
+  header[22] = AUDIO_CHANNELS;
+  header[23] = 0;
+  value = AUDIO_RATE;
+  memcpy(header + 24, &value, 4);
+  memcpy(header + 28, &byteRate, 4);
+  header[32] = AUDIO_CHANNELS * 2; // block align
+  header[33] = 0;
+  header[34] = 16; // bits per sample
+  header[35] = 0;
+  memcpy(header + 36, "data", 4);
+  memcpy(header + 40, &dataSize, 4);
+}
+
+bool openCaptureFile(captureFile *file, const char *path, bool direct) {
+  file->fd = -1;
+  file->staged = 0;
+  file->written = 0;
+  if (path == NULL) {
+    return true;
+  }
+
+  if (direct) {
+    file->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+  }
+  if (file->fd < 0) { // not asked for, or the filesystem refused O_DIRECT
+    file->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  }
+  if (file->fd < 0) {
+    printf("Error: could not open %s\n", path);
+    return false;
+  }
+  if (posix_memalign((void **) &file->staging, 4096, CAPTURE_WRITE_SIZE) != 0) {
+    printf("Error: could not allocate capture buffer\n");
+    close(file->fd);
+    file->fd = -1;
+    return false;
+  }
+  return true;
+}
+
+void closeCaptureFile(captureFile *file, captureStream stream) {
+  if (file->fd < 0) {
+    return;
+  }
+
+  fcntl(file->fd, F_SETFL, fcntl(file->fd, F_GETFL) & ~O_DIRECT);
+  if (!writeFailed && file->staged > 0 && !writeAll(file->fd, file->staging, file->staged)) {
+    printf("Error: capture write failed\n");
+  }
+  if (stream == STREAM_AUDIO) { // the sizes are only known now
+    uint8_t header[WAV_HEADER_SIZE];
+    writeWAVHeader(header, file->written - WAV_HEADER_SIZE);
+    if (pwrite(file->fd, header, WAV_HEADER_SIZE, 0) != WAV_HEADER_SIZE) {
+      printf("Error: could not update WAV header\n");
+    }
+  }
+  close(file->fd);
+  free(file->staging);
+  file->fd = -1;
+}
+
+// Start writing video to videoPath as Y4M and audio to audioPath as 16-bit
+// stereo WAV. Either path may be NULL.
+bool startCapture(const char *videoPath, const char *audioPath, bool direct) {
+  char header[128];
+  int i;
+
+  memset(&capture, 0, sizeof(capture));
+  queueHead = queueTail = queued = 0;
+  writerStopping = false;
+  writeFailed = false;
+
+  if (!openCaptureFile(&files[STREAM_VIDEO], videoPath, direct)) {
+    return false;
+  }
+  if (!openCaptureFile(&files[STREAM_AUDIO], audioPath, direct)) {
+    closeCaptureFile(&files[STREAM_VIDEO], STREAM_VIDEO);
+    return false;
+  }
+  for (i = 0; i < CAPTURE_SLOTS; i++) {
+    slots[i].data = malloc(CAPTURE_SLOT_SIZE);
+  }
+
+  // no writer yet, so the headers can be staged directly
+  if (files[STREAM_VIDEO].fd >= 0) {
+    int length = snprintf(header, sizeof(header),
+			  "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n",
+			  SCREEN_WIDTH, SCREEN_HEIGHT, CPU_CLOCK, CYCLES_PER_FRAME);
+    stageData(&files[STREAM_VIDEO], (uint8_t *) header, length);
+  }
+  if (files[STREAM_AUDIO].fd >= 0) {
+    writeWAVHeader((uint8_t *) header, 0);
+    stageData(&files[STREAM_AUDIO], (uint8_t *) header, WAV_HEADER_SIZE);
+  }
+
+  audioCycle = cycles;
+  if (pthread_create(&writerThread, NULL, writerMain, NULL) != 0) {
+    printf("Error: could not start capture writer\n");
+    closeCaptureFile(&files[STREAM_VIDEO], STREAM_VIDEO);
+    closeCaptureFile(&files[STREAM_AUDIO], STREAM_AUDIO);
+    return false;
+  }
+  capturing = true;
+  return true;
+}
+
+// Queue an interleaved stereo block of count sample frames.
+void captureAudio(const int16_t *samples, int count) {
+  const uint32_t blockFrames = CAPTURE_SLOT_SIZE / (AUDIO_CHANNELS * 2);
+
+  if (!capturing || files[STREAM_AUDIO].fd < 0) {
+    return;
+  }
+  while (count > 0) {
+    uint32_t frames = count < (int) blockFrames ? (uint32_t) count : blockFrames;
+    captureSlot *slot = acquireSlot();
+    slot->stream = STREAM_AUDIO;
+    slot->length = frames * AUDIO_CHANNELS * 2;
+    if (samples != NULL) {
+      memcpy(slot->data, samples, slot->length);
+      samples += frames * AUDIO_CHANNELS;
+    }
+    else {
+      memset(slot->data, 0, slot->length);
+    }
+    submitSlot();
+    capture.audioBlocks++;
+    count -= frames;
+  }
+}
+
+// Queue the framebuffer as one Y4M frame. Called at the end of every frame.
+void captureFrame() {
+  int i;
+
+  if (!capturing) {
+    return;
+  }
+
+  if (files[STREAM_VIDEO].fd >= 0) {
+    captureSlot *slot = acquireSlot();
+    uint8_t *out = slot->data;
+    slot->stream = STREAM_VIDEO;
+    slot->length = Y4M_FRAME_SIZE;
+    memcpy(out, Y4M_FRAME_HEADER, sizeof(Y4M_FRAME_HEADER) - 1);
+    out += sizeof(Y4M_FRAME_HEADER) - 1;
+    for (i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+      out[i] = shadeLuma[framebuffer[i] & 3];
+    }
+    memset(out + SCREEN_WIDTH * SCREEN_HEIGHT, 128, SCREEN_WIDTH * SCREEN_HEIGHT / 2);
+    submitSlot();
+    capture.frames++;
+  }
+
+  // There is no APU yet, so keep the audio track in step with the video by
+  // padding it with silence for the cycles this frame took.
+  uint64_t samples = (cycles * AUDIO_RATE) / CPU_CLOCK - (audioCycle * AUDIO_RATE) / CPU_CLOCK;
+  audioCycle = cycles;
+  captureAudio(NULL, samples);
+}
+
+void stopCapture() {
+  int i;
+
+  if (!capturing) {
+    return;
+  }
+  capturing = false;
+
+  pthread_mutex_lock(&queueLock);
+  writerStopping = true;
+  pthread_cond_signal(&queueReady);
+  pthread_mutex_unlock(&queueLock);
+  pthread_join(writerThread, NULL);
+
+  closeCaptureFile(&files[STREAM_VIDEO], STREAM_VIDEO);
+  closeCaptureFile(&files[STREAM_AUDIO], STREAM_AUDIO);
+  for (i = 0; i < CAPTURE_SLOTS; i++) {
+    free(slots[i].data);
+  }
+
+  printf("capture: %llu frames, %llu audio blocks, %llu bytes in %llu writes\n",
+	 (unsigned long long) capture.frames, (unsigned long long) capture.audioBlocks,
+	 (unsigned long long) capture.bytesWritten, (unsigned long long) capture.writes);
+  printf("capture: queue peaked at %u of %d slots, %llu stalls (%.3f ms)\n",
+	 capture.maxQueued, CAPTURE_SLOTS, (unsigned long long) capture.stalls,
+	 capture.stallNanoseconds / 1e6);
+}
@@ -0,0 +1,31 @@
+#ifndef CAPTURE_H_INCLUDED
+#define CAPTURE_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CAPTURE_SLOTS 16
+#define CAPTURE_SLOT_SIZE 0x10000
+#define CAPTURE_WRITE_SIZE 0x100000 // bytes per write call, a multiple of 4096
+
+#define AUDIO_RATE 48000
+#define AUDIO_CHANNELS 2
+
+typedef struct {
+  uint64_t frames;       // video frames queued
+  uint64_t audioBlocks;  // audio blocks queued
+  uint64_t stalls;       // times the emulator waited for a free slot
+  uint64_t stallNanoseconds;
+  uint32_t maxQueued;    // deepest the queue got
+  uint64_t bytesWritten;
+  uint64_t writes;       // write calls made by the writer thread
+} captureStats;
+
+extern captureStats capture;
+
+bool startCapture(const char *, const char *, bool);
+void captureFrame(void);
+void captureAudio(const int16_t *, int);
+void stopCapture(void);
+
+#endif
@@ -0,0 +1,310 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cartridge.h"
+#include "cheats.h"
+#include "metrics.h"
+#include "statehash.h"
+
+uint8_t *rom = NULL;
+size_t romSize = 0;
+size_t romBanks = 0;
+
+// Cartridge RAM. Battery-backed RAM with a save file is a MAP_SHARED
+// mapping of that file, so the CPU writes straight into the page cache and
+// syncBatteryRAM only has to msync it.
+uint8_t *sram = NULL;
+size_t sramSize = 0;
+bool batteryBacked = false;
+bool sramMapped = false;
+int syncInterval = SYNC_INTERVAL;
+int framesSinceSync = 0;
+
+mbcState mbc;
+
+// what disabled or missing cartridge RAM reads as
+uint8_t openBus[0x100];
+
+const size_t ramSizes[6] = { 0, 0x800, 0x2000, 0x8000, SRAM_MAX_SIZE, 0x10000 };
+
+bool parseHeader() {
+  uint8_t type = rom[0x147];
+  uint8_t ramCode = rom[0x149];
+
+  batteryBacked = false;
+  switch (type) {
+  case 0x00:
+  case 0x08:
+    mbc.type = MBC_NONE;
+    break;
+  case 0x09:
+    mbc.type = MBC_NONE;
+    batteryBacked = true;
+    break;
+  case 0x01:
+  case 0x02:
+  case 0x03:
+    mbc.type = MBC_1;
+    batteryBacked = type == 0x03;
+    break;
+  case 0x0F:
+  case 0x10:
+  case 0x11:
+  case 0x12:
+  case 0x13:
+    mbc.type = MBC_3;
+    batteryBacked = type == 0x0F || type == 0x10 || type == 0x13;
+    break;
+  case 0x19:
+  case 0x1A:
+  case 0x1B:
+  case 0x1C:
+  case 0x1D:
+  case 0x1E:
+    mbc.type = MBC_5;
+    batteryBacked = type == 0x1B || type == 0x1E;
+    break;
+  default:
+    printf("Error: unsupported cartridge type 0x%02X\n", type);
+    return false;
+  }
+
+  sramSize = ramCode < 6 ? ramSizes[ramCode] : 0;
+  if (sramSize > 0 && sramSize < 0x2000) { // 2KB parts still fill a bank slot
+    sramSize = 0x2000;
+  }
+  return true;
+}
+
+// Load a ROM image and map its first 32KB. The boot ROM stays on top of
+// 0x0000-0x00FF until the program writes to 0xFF50.
+bool loadROM(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    printf("Error: could not open ROM %s\n", path);
+    return false;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (size <= 0) {
+    printf("Error: ROM %s is empty\n", path);
+    fclose(file);
+    return false;
+  }
+
+  // whole 16KB banks, so a bank pointer never runs off the end
+  romBanks = (size + 0x3FFF) / 0x4000;
+  if (romBanks < 2) {
+    romBanks = 2;
+  }
+  free(rom);
+  rom = malloc(romBanks * 0x4000);
+  memset(rom, 0xFF, romBanks * 0x4000);
+  romSize = fread(rom, 1, size, file);
+  fclose(file);
+
+  if (romSize < 0x150 || !parseHeader()) {
+    printf("Error: %s is not a usable ROM\n", path);
+    return false;
+  }
+  closeBatteryRAM();
+  sram = sramSize > 0 ? calloc(sramSize, 1) : NULL;
+
+  mapROM();
+  memcpy(memory, bios, 256);
+  return true;
+}
+
+// Power-on mapping: the first 32KB copied in, MBC registers reset.
+void mapROM() {
+  if (rom != NULL) {
+    memcpy(memory, rom, romSize < 0x8000 ? romSize : 0x8000);
+  }
+  mbc.romBank = 1;
+  mbc.ramBank = 0;
+  mbc.bankHigh = 0;
+  mbc.mode = 0;
+  mbc.ramEnabled = mbc.type == MBC_NONE;
+}
+
+// Point 0x4000-0x7FFF and 0xA000-0xBFFF at the selected banks, and trap
+// writes to the MBC registers and to disabled RAM. Part of mapMemoryImage.
+void mapCartridge() {
+  int page;
+
+  if (rom == NULL) {
+    return;
+  }
+
+  for (page = 0; page < 0x80; page++) {
+    readOnlyPage[page] = true;
+  }
+  if (mbc.type != MBC_NONE) {
+    uint8_t *bank = rom + (mbc.romBank % romBanks) * 0x4000;
+    for (page = 0; page < 0x40; page++) {
+      pageBase[0x40 + page] = bank + (page << 8);
+    }
+  }
+
+  if (sram != NULL && mbc.ramEnabled) {
+    uint8_t *bank = sram + (mbc.ramBank % (sramSize / 0x2000)) * 0x2000;
+    for (page = 0; page < 0x20; page++) {
+      pageBase[0xA0 + page] = bank + (page << 8);
+      readOnlyPage[0xA0 + page] = false;
+    }
+  }
+  else {
+    memset(openBus, 0xFF, sizeof(openBus));
+    for (page = 0; page < 0x20; page++) {
+      pageBase[0xA0 + page] = openBus;
+      readOnlyPage[0xA0 + page] = true;
+    }
+  }
+}
+
+// Writes to 0x0000-0x7FFF, and to cartridge RAM while it is disabled.
+void writeCartridge(uint16_t address, uint8_t value) {
+  bool ramEnabled = mbc.ramEnabled;
+  uint16_t romBank = mbc.romBank;
+  uint8_t ramBank = mbc.ramBank;
+
+  if (address >= 0x8000 || mbc.type == MBC_NONE) {
+    return;
+  }
+
+  if (address < 0x2000) {
+    mbc.ramEnabled = (value & 0x0F) == 0x0A;
+  }
+  else if (mbc.type == MBC_1) {
+    if (address < 0x4000) {
+      mbc.romBank = (mbc.romBank & 0x60) | ((value & 0x1F) ? (value & 0x1F) : 1);
+    }
+    else if (address < 0x6000) {
+      mbc.bankHigh = value & 0x03;
+    }
+    else {
+      mbc.mode = value & 0x01;
+    }
+    mbc.romBank = (mbc.romBank & 0x1F) | mbc.bankHigh << 5;
+    mbc.ramBank = mbc.mode ? mbc.bankHigh : 0;
+  }
+  else if (mbc.type == MBC_3) {
+    if (address < 0x4000) {
+      mbc.romBank = (value & 0x7F) ? (value & 0x7F) : 1;
+    }
+    else if (address < 0x6000) {
+      mbc.ramBank = value & 0x03; // RTC registers are not emulated
+    }
+  }
+  else { // MBC5
+    if (address < 0x3000) {
+      mbc.romBank = (mbc.romBank & 0x100) | value;
+    }
+    else if (address < 0x4000) {
+      mbc.romBank = (mbc.romBank & 0xFF) | (value & 0x01) << 8;
+    }
+    else if (address < 0x6000) {
+      mbc.ramBank = value & 0x0F;
+    }
+  }
+
+  if (mbc.romBank != romBank || mbc.ramBank != ramBank) {
+    metrics.bankSwitches++;
+  }
+
+  // games disable RAM once they have finished saving, a good moment to
+  // start writing it back
+  if (ramEnabled && !mbc.ramEnabled && sramMapped) {
+    msync(sram, sramSize, MS_ASYNC);
+  }
+
+  // games rewrite the same bank often; only a change needs a remap
+  if (mbc.romBank != romBank || mbc.ramBank != ramBank || mbc.ramEnabled != ramEnabled) {
+    mapCartridge();
+    refreshPatches();
+  }
+}
+
+// Back battery RAM with the save file at path, creating it if needed.
+bool openBatteryRAM(const char *path) {
+  if (!batteryBacked || sramSize == 0) {
+    printf("Warning: cartridge has no battery-backed RAM, ignoring %s\n", path);
+    return true;
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    printf("Error: could not open save file %s\n", path);
+    return false;
+  }
+  // only ever grow the file: a longer one may carry an RTC footer or come
+  // from a cartridge with more RAM, and is left as it is past sramSize
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (st.st_size < (off_t) sramSize && ftruncate(fd, sramSize) != 0)) {
+    printf("Error: could not size save file %s\n", path);
+    close(fd);
+    return false;
+  }
+  uint8_t *mapping = mmap(NULL, sramSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    printf("Error: could not map save file %s\n", path);
+    return false;
+  }
+
+  free(sram);
+  sram = mapping;
+  sramMapped = true;
+  framesSinceSync = 0;
+  mapMemoryImage();
+  return true;
+}
+
+// Called once per frame; flushes the save file every syncInterval frames.
+void syncBatteryRAM() {
+  if (!sramMapped || syncInterval <= 0 || ++framesSinceSync < syncInterval) {
+    return;
+  }
+  framesSinceSync = 0;
+  msync(sram, sramSize, MS_SYNC);
+}
+
+void closeBatteryRAM() {
+  if (sramMapped) {
+    msync(sram, sramSize, MS_SYNC);
+    munmap(sram, sramSize);
+    sramMapped = false;
+  }
+  else {
+    free(sram);
+  }
+  sram = NULL;
+}
+
+void unmapBootROM() {
+  if (rom != NULL) {
+    memcpy(memory, rom, romSize < 256 ? romSize : 256);
+  }
+  else {
+    memset(memory, 0, 256);
+  }
+  markPageDirty(0x00);
+  refreshPatches();
+}
+
+// FNV-1a over the whole ROM, 0 when none is loaded
+uint32_t romChecksum() {
+  uint32_t hash = 2166136261u;
+  size_t i;
+  if (rom == NULL) {
+    return 0;
+  }
+  for (i = 0; i < romSize; i++) {
+    hash = (hash ^ rom[i]) * 16777619u;
+  }
+  return hash;
+}
@@ -0,0 +1,45 @@
+#ifndef CARTRIDGE_H_INCLUDED
+#define CARTRIDGE_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "memory.h"
+
+#define SYNC_INTERVAL 600 // frames between msyncs of battery RAM
+#define SRAM_MAX_SIZE 0x20000
+
+typedef enum { MBC_NONE, MBC_1, MBC_3, MBC_5 } mbcType;
+
+// Bank registers. Switching banks points pageBase at the bank in rom or
+// sram; nothing is copied.
+typedef struct {
+  uint8_t type;
+  uint16_t romBank;
+  uint8_t ramBank;
+  uint8_t bankHigh;   // MBC1 0x4000-0x5FFF register
+  uint8_t mode;       // MBC1 banking mode
+  bool ramEnabled;
+} mbcState;
+
+extern uint8_t *rom;
+extern size_t romSize;
+extern size_t romBanks;
+extern uint8_t *sram;
+extern size_t sramSize;
+extern bool batteryBacked;
+extern bool sramMapped;
+extern mbcState mbc;
+extern int syncInterval;
+
+bool loadROM(const char *);
+void mapROM(void);
+void unmapBootROM(void);
+uint32_t romChecksum(void);
+void mapCartridge(void);
+void writeCartridge(uint16_t, uint8_t);
+bool openBatteryRAM(const char *);
+void syncBatteryRAM(void);
+void closeBatteryRAM(void);
+
+#endif
@@ -0,0 +1,124 @@
+#include "cgb.h"
+#include "cpu.h"
+#include "memory.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "statehash.h"
+#include "timer.h"
+
+bool cgbMode = false;
+cgbState cgb;
+
+void initializeCGB() {
+  memset(&cgb, 0, sizeof(cgb));
+  cgb.wramBank = 1;
+  cycleShift = 0;
+  if (cgbMode) {
+    memory[0xFF4D] = 0x7E;
+    memory[0xFF4F] = 0xFE;
+    memset(memory + 0xFF51, 0xFF, 5);
+    memory[0xFF70] = 0xF8;
+  }
+  mapMemoryImage();
+}
+
+// Point the VRAM and WRAM windows (and the echo of WRAM) at the selected
+// banks. Leaves refreshing the fast tables to the caller.
+void mapBanks() {
+  int page;
+  uint8_t *vram = cgb.vramBank ? cgb.vram1 : memory + 0x8000;
+  uint8_t *wram = cgb.wramBank > 1 ? cgb.wram[cgb.wramBank - 2] : memory + 0xD000;
+
+  for (page = 0; page < 0x20; page++) {
+    pageBase[0x80 + page] = vram + (page << 8);
+  }
+  for (page = 0; page < 0x10; page++) {
+    pageBase[0xD0 + page] = wram + (page << 8);
+    if (page < 0x0E) {
+      pageBase[0xF0 + page] = wram + (page << 8);
+    }
+  }
+}
+
+void hdmaBlock() {
+  uint8_t *source = pageBase[cgb.hdmaSource >> 8] + (cgb.hdmaSource & 0xFF);
+  uint8_t *dest = pageBase[cgb.hdmaDest >> 8] + (cgb.hdmaDest & 0xFF);
+
+  memcpy(dest, source, 16);
+  markPageDirty(cgb.hdmaDest >> 8);
+  if (pipelineActive && dest == memory + cgb.hdmaDest) { // VRAM bank 0
+    pipelineBlock(cgb.hdmaDest, 16);
+  }
+  cgb.hdmaSource += 16;
+  cgb.hdmaDest = 0x8000 | ((cgb.hdmaDest + 16) & 0x1FF0);
+  cgb.hdmaBlocks--;
+  cycles += HDMA_BLOCK_CYCLES;
+
+  if (cgb.hdmaBlocks == 0) {
+    cgb.hdmaActive = false;
+    memory[0xFF55] = 0xFF;
+  }
+  else {
+    memory[0xFF55] = cgb.hdmaBlocks - 1;
+  }
+}
+
+void startHDMA(uint8_t value) {
+  if (cgb.hdmaActive && !(value & 0x80)) { // cancel, FF55 shows what was left
+    cgb.hdmaActive = false;
+    memory[0xFF55] = 0x80 | (cgb.hdmaBlocks - 1);
+    return;
+  }
+
+  cgb.hdmaSource = (memory[0xFF51] << 8 | memory[0xFF52]) & 0xFFF0;
+  cgb.hdmaDest = 0x8000 | ((memory[0xFF53] << 8 | memory[0xFF54]) & 0x1FF0);
+  cgb.hdmaBlocks = (value & 0x7F) + 1;
+
+  if (value & 0x80) { // HDMA, one block per HBlank from the PPU
+    cgb.hdmaActive = true;
+    memory[0xFF55] = value & 0x7F;
+    return;
+  }
+  while (cgb.hdmaBlocks > 0) { // GDMA, all at once
+    hdmaBlock();
+  }
+}
+
+// Taken on STOP with KEY1 bit 0 set.
+void switchSpeed() {
+  cgb.doubleSpeed = !cgb.doubleSpeed;
+  setTimerSpeed(cgb.doubleSpeed);
+  memory[0xFF4D] = cgb.doubleSpeed ? 0xFE : 0x7E;
+}
+
+void writeCGB(uint16_t address, uint8_t value) {
+  switch (address) {
+  case 0xFF4D: // KEY1, only the switch request is writable
+    memory[address] = (memory[address] & 0xFE) | (value & 0x01);
+    break;
+  case 0xFF4F: // VBK
+    memory[address] = 0xFE | value;
+    if (cgb.vramBank != (value & 0x01)) {
+      metrics.bankSwitches++;
+    }
+    cgb.vramBank = value & 0x01;
+    mapBanks();
+    refreshPages();
+    break;
+  case 0xFF55: // HDMA5
+    startHDMA(value);
+    break;
+  case 0xFF70: // SVBK, bank 0 selects 1
+    memory[address] = 0xF8 | value;
+    value = (value & 0x07) ? (value & 0x07) : 1;
+    if (cgb.wramBank != value) {
+      metrics.bankSwitches++;
+    }
+    cgb.wramBank = value;
+    mapBanks();
+    refreshPages();
+    break;
+  default: // HDMA1-4
+    memory[address] = value;
+  }
+}
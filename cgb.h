@@ -0,0 +1,34 @@
+#ifndef CGB_H_INCLUDED
+#define CGB_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// GDMA and each HDMA block stall the CPU for this long whatever the speed
+#define HDMA_BLOCK_CYCLES 32
+
+// Banked memory and the speed switch. VRAM bank 0 and WRAM bank 1 are the
+// usual parts of memory[]; the other banks live here and are switched in by
+// pointing pageBase at them.
+typedef struct {
+  uint8_t vram1[0x2000];
+  uint8_t wram[6][0x1000]; // banks 2-7
+  uint8_t vramBank;
+  uint8_t wramBank;
+  bool doubleSpeed;
+  bool hdmaActive;
+  uint16_t hdmaSource;
+  uint16_t hdmaDest;
+  uint8_t hdmaBlocks;     // 16-byte blocks left
+} cgbState;
+
+extern bool cgbMode;
+extern cgbState cgb;
+
+void initializeCGB(void);
+void mapBanks(void);
+void writeCGB(uint16_t, uint8_t);
+void switchSpeed(void);
+void hdmaBlock(void);
+
+#endif
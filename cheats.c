@@ -0,0 +1,155 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "cheats.h"
+#include "memory.h"
+#include "pipeline.h"
+#include "render.h"
+#include "statehash.h"
+
+// ROM patches never touch the read path. Each ROM page with a patch that
+// applies gets a patched copy, and patchPage points readPage at it, so
+// reads from every other page stay direct. Freezes are a short list written
+// back once per frame.
+
+romPatch patches[MAX_PATCHES];
+int patchCount = 0;
+ramFreeze freezes[MAX_FREEZES];
+int freezeCount = 0;
+
+uint8_t patchedPages[0x80][0x100];
+
+int hexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c = toupper(c);
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// "ABC-DEF" or "ABC-DEF-GHI": AB is the value and FCDE the address, with F
+// inverted. The compare byte is GI rotated right by 2, then XORed with 0xBA.
+bool parseGameGenie(const int *d, int length) {
+  romPatch patch;
+
+  patch.value = d[0] << 4 | d[1];
+  patch.address = (d[5] ^ 0xF) << 12 | d[2] << 8 | d[3] << 4 | d[4];
+  patch.compare = -1;
+  if (length == 9) {
+    uint8_t compare = d[6] << 4 | d[8];
+    compare = (compare >> 2 | compare << 6) ^ 0xBA;
+    patch.compare = compare;
+  }
+  if (patch.address >= 0x8000) {
+    printf("Error: Game Genie address 0x%04X is not in ROM\n", patch.address);
+    return false;
+  }
+  if (patchCount == MAX_PATCHES) {
+    printf("Error: too many ROM patches\n");
+    return false;
+  }
+  patches[patchCount++] = patch;
+  refreshPatches();
+  return true;
+}
+
+// "ttvvllhh": type, value, then the address low byte first. The RAM bank in
+// the type byte is ignored.
+bool parseGameShark(const int *d) {
+  ramFreeze freeze;
+
+  freeze.value = d[2] << 4 | d[3];
+  freeze.address = (d[6] << 4 | d[7]) << 8 | d[4] << 4 | d[5];
+  if (freeze.address < 0x8000 || (freeze.address >= 0xFF00 && freeze.address < 0xFF80)) {
+    printf("Error: GameShark address 0x%04X is not RAM\n", freeze.address);
+    return false;
+  }
+  if (freezeCount == MAX_FREEZES) {
+    printf("Error: too many RAM freezes\n");
+    return false;
+  }
+  freezes[freezeCount++] = freeze;
+  return true;
+}
+
+// Add a Game Genie (ABC-DEF[-GHI]) or GameShark (8 hex digits) code.
+bool addCheat(const char *code) {
+  int digits[9];
+  int length = 0;
+  bool dashes = false;
+
+  for (; *code; code++) {
+    if (*code == '-') {
+      dashes = true;
+      continue;
+    }
+    if (length == 9 || hexDigit(*code) < 0) {
+      length = -1;
+      break;
+    }
+    digits[length++] = hexDigit(*code);
+  }
+
+  if (length == 6 || length == 9) {
+    return parseGameGenie(digits, length);
+  }
+  if (length == 8 && !dashes) {
+    return parseGameShark(digits);
+  }
+  printf("Error: unrecognized cheat code\n");
+  return false;
+}
+
+void clearCheats() {
+  patchCount = 0;
+  freezeCount = 0;
+  refreshPatches();
+}
+
+// Rebuild the patched ROM pages from what is mapped now. Called whenever a
+// patch is added or what sits under 0x0000-0x7FFF changes.
+void refreshPatches() {
+  int i;
+
+  memset(patchPage, 0, 0x80 * sizeof(patchPage[0]));
+  for (i = 0; i < patchCount; i++) {
+    int page = patches[i].address >> 8;
+    int offset = patches[i].address & 0xFF;
+    if (patches[i].compare >= 0 && pageBase[page][offset] != patches[i].compare) {
+      continue;
+    }
+    if (patchPage[page] == NULL) {
+      memcpy(patchedPages[page], pageBase[page], 0x100);
+      patchPage[page] = patchedPages[page];
+    }
+    patchPage[page][offset] = patches[i].value;
+  }
+  refreshPages();
+}
+
+void applyFreezes() {
+  int i;
+  for (i = 0; i < freezeCount; i++) {
+    uint16_t address = freezes[i].address;
+    if (readOnlyPage[address >> 8]) { // ROM, or disabled RAM on the shared openBus page
+      continue;
+    }
+    if (address < 0xFF00) {
+      pageBase[address >> 8][address & 0xFF] = freezes[i].value;
+      markPageDirty(address >> 8);
+      if (address >= 0xFE00) {
+	invalidateSprites();
+      }
+      if (pipelineActive && pageBase[address >> 8] == memory + (address & 0xFF00) &&
+	  ((address >= 0x8000 && address < 0xA000) || address >= 0xFE00)) {
+	pipelineWrite(address, freezes[i].value);
+      }
+    }
+    else {
+      memory[address] = freezes[i].value;
+    }
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef CHEATS_H_INCLUDED
+#define CHEATS_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_PATCHES 64
+#define MAX_FREEZES 64
+
+// Game Genie: replace a ROM byte, optionally only if it currently holds
+// compare (-1 for no compare).
+typedef struct {
+  uint16_t address;
+  uint8_t value;
+  int16_t compare;
+} romPatch;
+
+// GameShark: hold a RAM byte at value.
+typedef struct {
+  uint16_t address;
+  uint8_t value;
+} ramFreeze;
+
+extern int patchCount;
+extern int freezeCount;
+
+bool addCheat(const char *);
+void clearCheats(void);
+void refreshPatches(void);
+void applyFreezes(void);
+
+#endif
@@ -4,6 +4,12 @@ uint16_t pc, sp;
 uint8_t registers[8];
 bool prefixCB;
 bool interruptsEnabled;
+uint64_t cycles;
+uint64_t frameCount;
+uint64_t cycleLimit = NO_EVENT; // how far HALT may skip ahead
+uint8_t cycleShift = 0; // 1 in CGB double speed, where instructions take half the time
+bool stopOnUnimplemented = false; // record in unimplementedOpcode instead of exiting
+int unimplementedOpcode = -1;     // 0x100 set for extended opcodes
 
 const uint8_t opcodeLength[] = {
   1,3,1,1,1,1,2,1,3,1,1,1,1,1,2,1,
@@ -24,6 +30,26 @@ const uint8_t opcodeLength[] = {
   2,1,2,1,0,1,2,1,2,1,3,1,0,0,2,1
 };
 
+// T-cycles per opcode, conditional branches counted as not taken
+const uint8_t opcodeCycles[] = {
+  4,12,8,8,4,4,8,4,20,8,8,8,4,4,8,4,
+  4,12,8,8,4,4,8,4,12,8,8,8,4,4,8,4,
+  8,12,8,8,4,4,8,4,8,8,8,8,4,4,8,4,
+  8,12,8,8,12,12,12,4,8,8,8,8,4,4,8,4,
+  4,4,4,4,4,4,8,4,4,4,4,4,4,4,8,4,
+  4,4,4,4,4,4,8,4,4,4,4,4,4,4,8,4,
+  4,4,4,4,4,4,8,4,4,4,4,4,4,4,8,4,
+  8,8,8,8,8,8,4,8,4,4,4,4,4,4,8,4,
+  4,4,4,4,4,4,8,4,4,4,4,4,4,4,8,4,
+  4,4,4,4,4,4,8,4,4,4,4,4,4,4,8,4,
+  4,4,4,4,4,4,8,4,4,4,4,4,4,4,8,4,
+  4,4,4,4,4,4,8,4,4,4,4,4,4,4,8,4,
+  8,12,12,16,12,16,8,16,8,16,12,4,12,24,8,16,
+  8,12,12,0,12,16,8,16,8,16,12,0,12,0,8,16,
+  12,12,8,0,0,16,8,16,16,4,16,0,0,0,8,16,
+  12,12,8,4,0,16,8,16,12,8,16,4,0,0,8,16
+};
+
 void initializeCPU() {
   pc = 0x0;
   //  sp = 0xFFFE;
@@ -35,16 +61,72 @@ void mainLoop() {
   bool running = true;
   int count = 100;
   
-  uint8_t opcode;
   while(running && count > 0) {
-    opcode = readNextByte();
-    executeOpcode(opcode);
-    printRegisters();
-    printf("\n");
+    step();
+    if (traceEnabled) {
+      printRegisters();
+      printf("\n");
+    }
     count--;
   }
 }
 
+// One instruction plus whatever events and interrupts it made due.
+void step() {
+  executeOpcode(readNextByte());
+  metrics.instructions++;
+  if (cycles >= nextEventCycle) {
+    runEvents();
+  }
+  if (interruptSignal) {
+    serviceInterrupts();
+  }
+}
+
+// Run until the cycle counter crosses the end of the current frame.
+void runFrame() {
+  beginFrame();
+  while (cycles < cycleLimit) {
+    step();
+  }
+  endFrame();
+}
+
+// Per-frame work around the instruction loop; cycleLimit is the end of the
+// frame in between.
+void beginFrame() {
+  applyFreezes();
+  cycleLimit = (frameCount + 1) * CYCLES_PER_FRAME;
+}
+
+void endFrame() {
+  cycleLimit = NO_EVENT;
+  frameCount++;
+  bool published = pipelineActive ? pipelineFrame() : true;
+  endSharedFrame();
+  if (published) {
+    captureFrame();
+  }
+  syncBatteryRAM();
+  exportMetrics();
+}
+
+void saveCPUState(cpuState *state) {
+  state->pc = pc;
+  state->sp = sp;
+  memcpy(state->registers, registers, sizeof(registers));
+  state->prefixCB = prefixCB;
+  state->interruptsEnabled = interruptsEnabled;
+}
+
+void loadCPUState(const cpuState *state) {
+  pc = state->pc;
+  sp = state->sp;
+  memcpy(registers, state->registers, sizeof(registers));
+  prefixCB = state->prefixCB;
+  interruptsEnabled = state->interruptsEnabled;
+}
+
 uint8_t readNextByte() {
   uint8_t byte = readMemory(pc);
   pc++;
@@ -64,7 +146,7 @@ uint16_t combineBytes(uint8_t high, uint8_t low) {
 }
 
 uint8_t getBit(uint8_t value, uint8_t n) {
-  return (value & (uint8_t) pow(2,n)) >> n;
+  return n < 8 ? (value >> n) & 1 : 0;
 }
 
 const char *byteToBinary(uint8_t x)
@@ -213,7 +295,11 @@ void executeOpcode(uint8_t opcode) {
       byteB = readNextByte();
     }
 
-    printf("opcode: 0x%02X 0x%02X 0x%02X\n", opcode, byteA, byteB);    
+    cycles += opcodeCycles[opcode] >> cycleShift;
+
+    if (traceEnabled) {
+      printf("opcode: 0x%02X 0x%02X 0x%02X\n", opcode, byteA, byteB);
+    }
   
     switch(opcode) {
     case 0x00:
@@ -953,12 +1039,25 @@ void executeOpcode(uint8_t opcode) {
       RST(0x38);
       break;
     default:
+      if (stopOnUnimplemented) {
+	unimplementedOpcode = opcode;
+	break;
+      }
       printf("Error, unimplemented opcode %#04X\n", opcode);
       exit(1);
     }
   }
   else { // extended opcode
-    printf("extended opcode: 0x%02X 0x%02X 0x%02X\n", opcode, byteA, byteB);
+    if ((opcode & 0x07) != 0x06) {
+      cycles += 4 >> cycleShift;
+    }
+    else {
+      cycles += ((opcode & 0xC0) == 0x40 ? 8 : 12) >> cycleShift; // BIT n,(HL) only reads
+    }
+
+    if (traceEnabled) {
+      printf("extended opcode: 0x%02X 0x%02X 0x%02X\n", opcode, byteA, byteB);
+    }
 
     switch(opcode) {
     case 0x11:
@@ -972,6 +1071,10 @@ void executeOpcode(uint8_t opcode) {
       readNextByte(); // do length properly
       break;
     default:
+      if (stopOnUnimplemented) {
+	unimplementedOpcode = 0x100 | opcode;
+	break;
+      }
       printf("Error, unimplemented extended opcode 0x%02x\n", opcode);
       exit(1);      
     }
@@ -1033,136 +1136,77 @@ void POP(registerName reg) {
 
 void ADD(uint8_t value) {
   uint8_t registerValue = readReg(REG_A);
-  uint8_t result = registerValue + value;  
-  setFlag('Z', result == 0);
-  setFlag('N', false);
-  setFlag('H', getBit(3, registerValue) && getBit(3, value));
-  setFlag('C', getBit(7, registerValue) && getBit(7, value));
-
-  writeReg(REG_A, result);
+  registers[REG_F] = (registers[REG_F] & 0x0F) | addFlags[0][registerValue][value];
+  writeReg(REG_A, registerValue + value);
 }
 
 void ADC(uint8_t value) {
   uint8_t registerValue = readReg(REG_A);
-  uint8_t result = registerValue + value + getFlag('C');
-  
-  setFlag('Z', result == 0);
-  setFlag('N', false);
-  setFlag('H', getBit(3, registerValue) && getBit(3, value));
-  setFlag('C', getBit(7, registerValue) && getBit(7, value));
-
-  writeReg(REG_A, result);
+  uint8_t carry = getFlag('C');
+  registers[REG_F] = (registers[REG_F] & 0x0F) | addFlags[carry][registerValue][value];
+  writeReg(REG_A, registerValue + value + carry);
 }
 
 void SUB(uint8_t value) {
   uint8_t registerValue = readReg(REG_A);
-  uint8_t result = registerValue - value;
-  
-  setFlag('Z', result == 0);
-  setFlag('N', true);
-  setFlag('H', getBit(3, registerValue) || !getBit(3, value));
-  setFlag('C', getBit(7, registerValue) || !getBit(7, value));
-  
-  writeReg(REG_A, result);
+  registers[REG_F] = (registers[REG_F] & 0x0F) | subFlags[0][registerValue][value];
+  writeReg(REG_A, registerValue - value);
 }
 
 void SBC(uint8_t value) {
   uint8_t registerValue = readReg(REG_A);
-  uint8_t result = registerValue - value - getFlag('C');
-  
-  setFlag('Z', result == 0);
-  setFlag('N', true);
+  uint8_t carry = getFlag('C');
   // unsure about H and C flags
-  setFlag('H', getBit(3, registerValue) || !getBit(3, value));
-  setFlag('C', getBit(7, registerValue) || !getBit(7, value));
-  
-  writeReg(REG_A, result);
+  registers[REG_F] = (registers[REG_F] & 0x0F) | subFlags[carry][registerValue][value];
+  writeReg(REG_A, registerValue - value - carry);
 }
 
+// Z is only ever set here, never cleared.
 void AND(uint8_t value) {
   uint8_t result = readReg(REG_A) & value;
   writeReg(REG_A, result);
-  if (result == 0) {
-    setFlag('Z', true);
-  }
-  setFlag('N', false);
-  setFlag('H', true);
-  setFlag('C', false);
+  registers[REG_F] = (registers[REG_F] & (FLAG_Z | 0x0F)) | zeroFlag[result] | FLAG_H;
 }
 
 void XOR(uint8_t value) {
   uint8_t result = readReg(REG_A) ^ value;
   writeReg(REG_A, result);
-  if (result == 0) {
-    setFlag('Z', true);
-  }
-  setFlag('N', false);
-  setFlag('H', false);
-  setFlag('C', false);
+  registers[REG_F] = (registers[REG_F] & (FLAG_Z | 0x0F)) | zeroFlag[result];
 }
 
 void OR(uint8_t value) {
   uint8_t result = readReg(REG_A) | value;
   writeReg(REG_A, result);
-  if (result == 0) {
-    setFlag('Z', true);
-  }
-  setFlag('N', false);
-  setFlag('H', false);
-  setFlag('C', false);
+  registers[REG_F] = (registers[REG_F] & (FLAG_Z | 0x0F)) | zeroFlag[result];
 }
 
 void CP(uint8_t value) {
-  uint8_t registerValue = readReg(REG_A);
-  setFlag('Z', registerValue == value);
-  setFlag('N', true);
-  setFlag('H', getBit(3, registerValue) || !getBit(3, value));
-  setFlag('C', registerValue < value);
+  registers[REG_F] = (registers[REG_F] & 0x0F) | cpFlags[readReg(REG_A)][value];
 }
 
 
 void INC(registerName reg) {
   uint8_t registerValue = readReg(reg);
-  uint8_t result = registerValue + 1;
-
-  setFlag('Z', result == 0);
-  setFlag('N', false);
-  setFlag('H', (registerValue & 0xF) == 0xF); // probably
-    
-  writeReg(reg, result);
+  registers[REG_F] = (registers[REG_F] & (FLAG_C | 0x0F)) | incFlags[registerValue];
+  writeReg(reg, (uint8_t) (registerValue + 1));
 }
 
 void INC_mem(uint16_t address) {
   uint8_t memoryValue = readMemory(address);
-  uint8_t result = memoryValue + 1;
-
-  setFlag('Z', result == 0);
-  setFlag('N', false);
-  setFlag('H', (memoryValue & 0xF) == 0xF);
-    
-  writeMemory(address, result);
+  registers[REG_F] = (registers[REG_F] & (FLAG_C | 0x0F)) | incFlags[memoryValue];
+  writeMemory(address, memoryValue + 1);
 }
 
 void DEC(registerName reg) {
   uint8_t registerValue = readReg(reg);
-  uint8_t result = registerValue - 1;
-
-  setFlag('Z', result == 0);
-  setFlag('N', true);
-  setFlag('H', (registerValue & 0xF) == 0);
-
-  writeReg(reg, result);
+  registers[REG_F] = (registers[REG_F] & (FLAG_C | 0x0F)) | decFlags[registerValue];
+  writeReg(reg, (uint8_t) (registerValue - 1));
 }
 
 void DEC_mem(uint16_t address) {
   uint8_t memoryValue = readMemory(address);
-  uint8_t result = memoryValue - 1;
-
-  setFlag('Z', result == 0);
-  setFlag('N', true);
-  setFlag('H', (memoryValue & 0xF) == 0);
-
-  writeMemory(address, result);
+  registers[REG_F] = (registers[REG_F] & (FLAG_C | 0x0F)) | decFlags[memoryValue];
+  writeMemory(address, memoryValue - 1);
 }
 
 //
@@ -1201,20 +1245,14 @@ void SWAP(registerName reg) {
   uint8_t value = readReg(reg);
   uint8_t result = (value << 2) | (value >> 2);
   writeReg(reg, result);
-  setFlag('Z', result == 0);
-  setFlag('N', 0);
-  setFlag('H', 0);
-  setFlag('C', 0);  
+  registers[REG_F] = (registers[REG_F] & 0x0F) | zeroFlag[result];
 }
 
 void SWAP_mem(uint16_t address) {
   uint8_t value = readMemory(address);
   uint8_t result = (value << 2) | (value >> 2);
   writeMemory(address, result);
-  setFlag('Z', result == 0);
-  setFlag('N', 0);
-  setFlag('H', 0);
-  setFlag('C', 0);
+  registers[REG_F] = (registers[REG_F] & 0x0F) | zeroFlag[result];
 }
 
 void DAA() {
@@ -1245,18 +1283,45 @@ void NOP() {
 
 void HALT() {
   // power down cpu until interrupt occurs
+
+  // Nothing but an event can raise an interrupt, so jump from one event to
+  // the next instead of spinning. If the run ends first, stay on the HALT
+  // opcode so it resumes next time.
+  while (!(memory[0xFFFF] & memory[0xFF0F] & 0x1F)) {
+    uint64_t wake = nextEventCycle < cycleLimit ? nextEventCycle : cycleLimit;
+    if (wake == NO_EVENT || wake == cycleLimit) {
+      if (wake != NO_EVENT && wake > cycles) {
+	metrics.haltCycles += wake - cycles;
+	cycles = wake;
+      }
+      pc--;
+      return;
+    }
+    if (wake > cycles) {
+      metrics.haltCycles += wake - cycles;
+      cycles = wake;
+    }
+    runEvents();
+  }
 }
 
 void STOP() {
   // halt cpu and video until button pressed
+  if (cgbMode && (memory[0xFF4D] & 0x01)) { // CGB speed switch
+    switchSpeed();
+  }
 }
 
 void DI() {
   interruptsEnabled = false;
+  eiDelay = 0;
+  updateInterrupts();
 }
 
 void EI() {
-  interruptsEnabled = true;
+  // counted down once after EI itself and once after the next instruction
+  eiDelay = 2;
+  updateInterrupts();
 }
 
 //
@@ -1269,12 +1334,7 @@ void RLCA() {
 
   value = (value << 1) | carry;
   
-  if (value == 0) {
-    setFlag('Z', true);
-  }
-  setFlag('N', false);
-  setFlag('H', false);
-  setFlag('C', carry);
+  registers[REG_F] = (registers[REG_F] & (FLAG_Z | 0x0F)) | zeroFlag[value] | (carry << 4);
 
   writeReg(REG_A, value);
 }
@@ -1285,28 +1345,40 @@ void RLA() {
 
   value = (value << 1) | getFlag('C');
 
-  if (value == 0) {
-    setFlag('Z', true);
-  }
-  setFlag('N', false);
-  setFlag('H', false);
-  setFlag('C', carry);
+  registers[REG_F] = (registers[REG_F] & (FLAG_Z | 0x0F)) | zeroFlag[value] | (carry << 4);
 
   writeReg(REG_A, value);
 }
 
+void RL(registerName reg) {
+  uint8_t value = readReg(reg);
+  bool carry = getBit(value, 7);
+
+  value = (value << 1) | getFlag('C');
+
+  registers[REG_F] = (registers[REG_F] & 0x0F) | zeroFlag[value] | (carry << 4);
+
+  writeReg(reg, value);
+}
+
+void RL_mem(uint16_t address) {
+  uint8_t value = readMemory(address);
+  bool carry = getBit(value, 7);
+
+  value = (value << 1) | getFlag('C');
+
+  registers[REG_F] = (registers[REG_F] & 0x0F) | zeroFlag[value] | (carry << 4);
+
+  writeMemory(address, value);
+}
+
 void RRCA() {
   uint8_t value = readReg(REG_A);
   bool carry = getBit(value, 0);
 
   value = (value >> 1) | (carry << 7);
 
-  if (value == 0) {
-    setFlag('Z', true);
-  }
-  setFlag('N', false);
-  setFlag('H', false);
-  setFlag('C', carry);
+  registers[REG_F] = (registers[REG_F] & (FLAG_Z | 0x0F)) | zeroFlag[value] | (carry << 4);
 
   writeReg(REG_A, value);
 }
@@ -1317,12 +1389,7 @@ void RRA() {
 
   value = (value >> 1) | (getFlag('C') << 7);
 
-  if (value == 0) {
-    setFlag('Z', true);
-  }
-  setFlag('N', false);
-  setFlag('H', false);
-  setFlag('C', carry);
+  registers[REG_F] = (registers[REG_F] & (FLAG_Z | 0x0F)) | zeroFlag[value] | (carry << 4);
 
   writeReg(REG_A, value);
 }
@@ -1332,9 +1399,7 @@ void RRA() {
 //
 
 void BIT(uint8_t bit, uint8_t value) {
-  setFlag('Z', getBit(bit, value));
-  setFlag('N', false);
-  setFlag('H', true);
+  registers[REG_F] = (registers[REG_F] & (FLAG_C | 0x0F)) | (getBit(bit, value) << 7) | FLAG_H;
 }
 
 //
@@ -1348,24 +1413,28 @@ void JP(uint16_t address) {
 void JP_NZ(uint16_t address) {
   if (!getFlag('Z')) {
     pc = address;
+    cycles += 4 >> cycleShift;
   }
 }
 
 void JP_Z(uint16_t address) {
   if (getFlag('Z')) {
     pc = address;
+    cycles += 4 >> cycleShift;
   }
 }
 
 void JP_NC(uint16_t address) {
   if (!getFlag('C')) {
     pc = address;
+    cycles += 4 >> cycleShift;
   }
 }
 
 void JP_C(uint16_t address) {
   if (getFlag('C')) {
     pc = address;
+    cycles += 4 >> cycleShift;
   }
 }
 
@@ -1376,24 +1445,28 @@ void JR(uint8_t offset) {
 void JR_NZ(uint8_t offset) {
   if (!getFlag('Z')) {
     pc += offset;
+    cycles += 4 >> cycleShift;
   }
 }
 
 void JR_Z(uint8_t offset) {
   if (getFlag('Z')) {
     pc += offset;
+    cycles += 4 >> cycleShift;
   }
 }
 
 void JR_NC(uint8_t offset) {
   if (!getFlag('C')) {
     pc += offset;
+    cycles += 4 >> cycleShift;
   }
 }
 
 void JR_C(uint8_t offset) {
   if (getFlag('C')) {
     pc += offset;
+    cycles += 4 >> cycleShift;
   }
 }
 
@@ -1406,24 +1479,28 @@ void CALL(uint16_t address) {
 void CALL_NZ(uint16_t address) {
   if (!getFlag('Z')) {
     CALL(address);
+    cycles += 12 >> cycleShift;
   }
 }
 
 void CALL_Z(uint16_t address) {
   if (getFlag('Z')) {
     CALL(address);
+    cycles += 12 >> cycleShift;
   }
 }
 
 void CALL_NC(uint16_t address) {
   if (!getFlag('C')) {
     CALL(address);
+    cycles += 12 >> cycleShift;
   }
 }
 
 void CALL_C(uint16_t address) {
   if (getFlag('C')) {
     CALL(address);
+    cycles += 12 >> cycleShift;
   }
 }
 
@@ -1440,28 +1517,34 @@ void RET() {
 void RET_NZ() {
   if (!getFlag('Z')) {
     pc = popWord();
+    cycles += 12 >> cycleShift;
   }
 }
 
 void RET_Z() {
   if (getFlag('Z')) {
     pc = popWord();
+    cycles += 12 >> cycleShift;
   }
 }
 
 void RET_NC() {
   if (!getFlag('C')) {
     pc = popWord();
+    cycles += 12 >> cycleShift;
   }
 }
 
 void RET_C() {
   if (getFlag('C')) {
     pc = popWord();
+    cycles += 12 >> cycleShift;
   }
 }
 
 void RETI() {
   RET();
   interruptsEnabled = true;
+  eiDelay = 0;
+  updateInterrupts();
 }
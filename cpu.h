@@ -6,15 +6,52 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include "capture.h"
+#include "cartridge.h"
+#include "cgb.h"
+#include "cheats.h"
+#include "flags.h"
+#include "interrupts.h"
 #include "memory.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "scheduler.h"
+#include "shm.h"
+
+#define CYCLES_PER_FRAME 70224
 
 typedef enum { REG_A, REG_B, REG_C, REG_D, REG_E, REG_F,
 	       REG_H, REG_L, REG_AF, REG_BC, REG_DE, REG_HL } registerName;
 
+typedef struct {
+  uint16_t pc, sp;
+  uint8_t registers[8];
+  bool prefixCB;
+  bool interruptsEnabled;
+} cpuState;
+
+extern const uint8_t opcodeLength[];
+extern const uint8_t opcodeCycles[];
+extern uint16_t pc, sp;
+extern bool prefixCB;
+extern bool interruptsEnabled;
+extern uint64_t cycles;
+extern uint64_t frameCount;
+extern uint64_t cycleLimit;
+extern uint8_t cycleShift;
+extern bool stopOnUnimplemented;
+extern int unimplementedOpcode;
+
 void initializeCPU(void);
 void mainLoop(void);
+void step(void);
+void runFrame(void);
+void beginFrame(void);
+void endFrame(void);
 uint8_t readNextByte(void);
 void executeOpcode(uint8_t);
+void saveCPUState(cpuState *);
+void loadCPUState(const cpuState *);
 
 uint8_t getHighByte(uint16_t);
 uint8_t getLowByte(uint16_t);
@@ -0,0 +1,230 @@
+#include <ctype.h>
+#include "debugger.h"
+#include "cpu.h"
+#include "memory.h"
+#include "timer.h"
+
+// PC breakpoints, one bit per address. Only the debugger's run loop looks
+// at this, and only while breakpointCount is non-zero.
+uint8_t breakpointMap[0x2000];
+int breakpointCount = 0;
+
+// Watchpoints. A page holding any part of a watched range has its fast
+// readPage/writePage entry cleared, so only accesses to those pages reach
+// checkWatchpoint through readSlow/writeSlow.
+watchpoint watchpoints[MAX_WATCHPOINTS];
+int watchpointCount = 0;
+uint8_t watchPages[0x100];
+
+bool debugBreak = false;
+uint16_t hitAddress;
+uint8_t hitType;
+
+bool testBreakpoint(uint16_t address) {
+  return breakpointMap[address >> 3] & (1 << (address & 7));
+}
+
+void setBreakpoint(uint16_t address) {
+  if (!testBreakpoint(address)) {
+    breakpointMap[address >> 3] |= 1 << (address & 7);
+    breakpointCount++;
+  }
+}
+
+void clearBreakpoint(uint16_t address) {
+  if (testBreakpoint(address)) {
+    breakpointMap[address >> 3] &= ~(1 << (address & 7));
+    breakpointCount--;
+  }
+}
+
+void updateWatchPages() {
+  int i, page;
+
+  memset(watchPages, 0, sizeof(watchPages));
+  for (i = 0; i < watchpointCount; i++) {
+    for (page = watchpoints[i].start >> 8; page <= watchpoints[i].end >> 8; page++) {
+      watchPages[page] |= watchpoints[i].type;
+    }
+  }
+  refreshPages();
+}
+
+bool addWatchpoint(uint16_t start, uint16_t end, uint8_t type) {
+  if (watchpointCount == MAX_WATCHPOINTS || end < start) {
+    return false;
+  }
+  watchpoints[watchpointCount].start = start;
+  watchpoints[watchpointCount].end = end;
+  watchpoints[watchpointCount].type = type;
+  watchpointCount++;
+  updateWatchPages();
+  return true;
+}
+
+void removeWatchpoint(int index) {
+  if (index < 0 || index >= watchpointCount) {
+    return;
+  }
+  watchpointCount--;
+  memmove(&watchpoints[index], &watchpoints[index + 1],
+	  (watchpointCount - index) * sizeof(watchpoint));
+  updateWatchPages();
+}
+
+// Called from the slow memory path for accesses to a trapping page.
+void checkWatchpoint(uint16_t address, uint8_t type) {
+  int i;
+  for (i = 0; i < watchpointCount; i++) {
+    if ((watchpoints[i].type & type) && address >= watchpoints[i].start &&
+	address <= watchpoints[i].end) {
+      debugBreak = true;
+      hitAddress = address;
+      hitType = type;
+      return;
+    }
+  }
+}
+
+// Read without side effects or watchpoint hits, for inspection.
+uint8_t peekMemory(uint16_t address) {
+  if (address >= 0xFF04 && address <= 0xFF05) {
+    return readTimer(address);
+  }
+  if (address < 0xFF00) {
+    return pageBase[address >> 8][address & 0xFF];
+  }
+  return memory[address];
+}
+
+void dumpMemory(uint16_t address, int length) {
+  int i;
+  for (i = 0; i < length; i++) {
+    if (i % 16 == 0) {
+      printf("%s%04X:", i ? "\n" : "", (uint16_t) (address + i));
+    }
+    printf(" %02X", peekMemory(address + i));
+  }
+  printf("\n");
+}
+
+void listPoints() {
+  int address, i;
+  for (address = 0; address < 0x10000; address++) {
+    if (testBreakpoint(address)) {
+      printf("break 0x%04X\n", address);
+    }
+  }
+  for (i = 0; i < watchpointCount; i++) {
+    printf("watch %d: 0x%04X-0x%04X %s%s\n", i, watchpoints[i].start, watchpoints[i].end,
+	   watchpoints[i].type & WATCH_READ ? "r" : "", watchpoints[i].type & WATCH_WRITE ? "w" : "");
+  }
+}
+
+// Run until a breakpoint or watchpoint fires, or count instructions retire.
+void debugRun(long count) {
+  debugBreak = false;
+  while (count != 0) {
+    step();
+    if (count > 0) {
+      count--;
+    }
+    if (debugBreak) {
+      printf("watchpoint: %s 0x%04X\n", hitType == WATCH_READ ? "read" : "write", hitAddress);
+      break;
+    }
+    if (breakpointCount && testBreakpoint(pc)) {
+      printf("breakpoint: 0x%04X\n", pc);
+      break;
+    }
+  }
+  debugBreak = false;
+  printRegisters();
+  printf("\n");
+}
+
+void debugHelp() {
+  printf("s [n]              step n instructions\n"
+	 "c                  continue until a breakpoint or watchpoint\n"
+	 "b addr             set a breakpoint\n"
+	 "d addr             delete a breakpoint\n"
+	 "w start [end] [rw] watch reads and/or writes to a range\n"
+	 "u n                remove watchpoint n\n"
+	 "l                  list breakpoints and watchpoints\n"
+	 "r                  show registers\n"
+	 "x addr [len]       dump memory\n"
+	 "q                  quit\n");
+}
+
+// Simple command loop over stdin.
+void debugger() {
+  char line[256];
+  char command[16], mode[4];
+  unsigned int a, b;
+  int fields;
+
+  printRegisters();
+  printf("\n");
+  while (printf("> "), fflush(stdout), fgets(line, sizeof(line), stdin) != NULL) {
+    mode[0] = '\0';
+    fields = sscanf(line, "%15s %x %x %3s", command, &a, &b, mode);
+    if (fields < 1) {
+      continue;
+    }
+    if (fields == 2) { // "w start rw"
+      sscanf(line, "%15s %x %3s", command, &a, mode);
+    }
+    switch (command[0]) {
+    case 's':
+      debugRun(fields > 1 ? (long) a : 1);
+      break;
+    case 'c':
+      debugRun(-1);
+      break;
+    case 'b':
+      if (fields > 1) {
+	setBreakpoint(a);
+      }
+      break;
+    case 'd':
+      if (fields > 1) {
+	clearBreakpoint(a);
+      }
+      break;
+    case 'w':
+      if (fields < 2) {
+	break;
+      }
+      if (fields == 2) {
+	b = a;
+      }
+      if (!addWatchpoint(a, b, strchr(mode, 'r') && !strchr(mode, 'w') ? WATCH_READ :
+			 strchr(mode, 'w') && !strchr(mode, 'r') ? WATCH_WRITE :
+			 WATCH_READ | WATCH_WRITE)) {
+	printf("Error: could not add watchpoint\n");
+      }
+      break;
+    case 'u':
+      if (fields > 1) {
+	removeWatchpoint(a);
+      }
+      break;
+    case 'l':
+      listPoints();
+      break;
+    case 'r':
+      printRegisters();
+      printf("\n");
+      break;
+    case 'x':
+      if (fields > 1) {
+	dumpMemory(a, fields > 2 ? (int) b : 16);
+      }
+      break;
+    case 'q':
+      return;
+    default:
+      debugHelp();
+    }
+  }
+}
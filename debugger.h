@@ -0,0 +1,30 @@
+#ifndef DEBUGGER_H_INCLUDED
+#define DEBUGGER_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_WATCHPOINTS 16
+
+#define WATCH_READ 1
+#define WATCH_WRITE 2
+
+typedef struct {
+  uint16_t start, end; // inclusive
+  uint8_t type;
+} watchpoint;
+
+extern uint8_t breakpointMap[0x2000];
+extern int breakpointCount;
+extern uint8_t watchPages[0x100];
+extern bool debugBreak;
+
+void setBreakpoint(uint16_t);
+void clearBreakpoint(uint16_t);
+bool addWatchpoint(uint16_t, uint16_t, uint8_t);
+void removeWatchpoint(int);
+void checkWatchpoint(uint16_t, uint8_t);
+uint8_t peekMemory(uint16_t);
+void debugger(void);
+
+#endif
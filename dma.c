@@ -0,0 +1,37 @@
+#include "dma.h"
+#include "cpu.h"
+#include "memory.h"
+#include "pipeline.h"
+#include "render.h"
+#include "scheduler.h"
+
+bool dmaActive;
+
+void initializeDMA() {
+  dmaActive = false;
+  cancelEvent(EVENT_DMA);
+  refreshPages();
+}
+
+// The CPU cannot see anything but HRAM until the transfer ends, so copying
+// the whole source page up front looks the same to it as the byte-by-byte
+// transfer. The lockout is done by clearing the fast page tables.
+void startDMA(uint8_t value) {
+  memory[0xFF46] = value;
+
+  uint8_t sourcePage = value >= 0xE0 ? value - 0x20 : value; // 0xE0-0xFF read echo RAM
+  memcpy(memory + 0xFE00, pageBase[sourcePage], 0xA0);
+  invalidateSprites();
+  if (pipelineActive) {
+    pipelineBlock(0xFE00, 0xA0);
+  }
+
+  dmaActive = true;
+  refreshPages();
+  scheduleEvent(EVENT_DMA, cycles + (DMA_CYCLES >> cycleShift));
+}
+
+void finishDMA() {
+  dmaActive = false;
+  refreshPages();
+}
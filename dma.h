@@ -0,0 +1,16 @@
+#ifndef DMA_H_INCLUDED
+#define DMA_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// OAM DMA takes 160 M-cycles
+#define DMA_CYCLES 640
+
+extern bool dmaActive;
+
+void initializeDMA(void);
+void startDMA(uint8_t);
+void finishDMA(void);
+
+#endif
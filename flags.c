@@ -0,0 +1,40 @@
+#include "flags.h"
+#include "cpu.h"
+
+uint8_t zeroFlag[0x100];
+uint8_t incFlags[0x100];
+uint8_t decFlags[0x100];
+uint8_t addFlags[2][0x100][0x100];
+uint8_t subFlags[2][0x100][0x100];
+uint8_t cpFlags[0x100][0x100];
+
+// Filled once before main rather than spelled out as initializers: 320KB
+// of those takes the compiler longer than the rest of the emulator.
+__attribute__((constructor))
+void buildFlagTables() {
+  int a, value, carry;
+
+  for (a = 0; a < 0x100; a++) {
+    zeroFlag[a] = a == 0 ? FLAG_Z : 0;
+    incFlags[a] = zeroFlag[(a + 1) & 0xFF] | ((a & 0xF) == 0xF ? FLAG_H : 0);
+    decFlags[a] = zeroFlag[(a - 1) & 0xFF] | FLAG_N | ((a & 0xF) == 0 ? FLAG_H : 0);
+  }
+
+  // getBit takes the value first; the ALU has always passed the bit number
+  // first, and these keep that
+  for (a = 0; a < 0x100; a++) {
+    for (value = 0; value < 0x100; value++) {
+      for (carry = 0; carry < 2; carry++) {
+	addFlags[carry][a][value] = zeroFlag[(a + value + carry) & 0xFF] |
+	  (getBit(3, a) && getBit(3, value) ? FLAG_H : 0) |
+	  (getBit(7, a) && getBit(7, value) ? FLAG_C : 0);
+	subFlags[carry][a][value] = zeroFlag[(a - value - carry) & 0xFF] | FLAG_N |
+	  (getBit(3, a) || !getBit(3, value) ? FLAG_H : 0) |
+	  (getBit(7, a) || !getBit(7, value) ? FLAG_C : 0);
+      }
+      cpFlags[a][value] = (a == value ? FLAG_Z : 0) | FLAG_N |
+	(getBit(3, a) || !getBit(3, value) ? FLAG_H : 0) |
+	(a < value ? FLAG_C : 0);
+    }
+  }
+}
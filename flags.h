@@ -0,0 +1,24 @@
+#ifndef FLAGS_H_INCLUDED
+#define FLAGS_H_INCLUDED
+
+#include <stdint.h>
+
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_H 0x20
+#define FLAG_C 0x10
+
+// The Z, N, H and C bits each 8-bit ALU operation leaves in F, by operand.
+// They follow the interpreter's rules exactly, including where those
+// differ from the hardware; ADC and SBC use the carry-in half of the add
+// and sub tables.
+extern uint8_t zeroFlag[0x100];               // by result
+extern uint8_t incFlags[0x100];               // by operand, C untouched
+extern uint8_t decFlags[0x100];
+extern uint8_t addFlags[2][0x100][0x100];     // [carry][A][operand]
+extern uint8_t subFlags[2][0x100][0x100];
+extern uint8_t cpFlags[0x100][0x100];
+
+void buildFlagTables(void);
+
+#endif
@@ -1,7 +1,236 @@
 #include "gb.h"
 
+#define KEYFRAME_INTERVAL 300
+
+void usage(const char *name) {
+  printf("usage: %s [rom] [--shm name] [--quiet] [--frames n [--aot]] [--debug]\n"
+	 "          [--frame-skip n|all] [--render-thread]\n"
+	 "          [--video y4m] [--audio wav] [--direct]\n"
+	 "          [--cheat code]... [--sav file [--sync-frames n]]\n"
+	 "          [--metrics file [--metrics-frames n]]\n"
+	 "          [--fast-boot [--cgb] | --verify-boot]\n"
+	 "          [--record movie [--input file] [--keyframes n]]\n"
+	 "          [--play movie [--seek frame]]\n"
+	 "          [--until pc=a|opcode=n|mem=a:n|serial=text|cycles=n|frames=n]...\n", name);
+}
+
 int main(int argc, const char* argv[]) {
-  initializeMemory();
-  initializeCPU();
-  mainLoop();
+  const char *romPath = NULL;
+  const char *sharedName = NULL;
+  const char *recordPath = NULL;
+  const char *inputPath = NULL;
+  const char *playPath = NULL;
+  const char *videoPath = NULL;
+  const char *audioPath = NULL;
+  const char *savePath = NULL;
+  const char *metricsPath = NULL;
+  long frames = -1;
+  long seekFrame = 0;
+  long keyframeInterval = KEYFRAME_INTERVAL;
+  bool fast = false;
+  bool verify = false;
+  bool debug = false;
+  bool direct = false;
+  bool compiled = false;
+  bool renderThread = false;
+  bootModel model = MODEL_DMG;
+  const char *cheats[MAX_PATCHES + MAX_FREEZES];
+  int cheatCount = 0;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+      sharedName = argv[++i];
+    }
+    else if (strcmp(argv[i], "--quiet") == 0) {
+      traceEnabled = false;
+    }
+    else if (strcmp(argv[i], "--debug") == 0) {
+      debug = true;
+    }
+    else if (strcmp(argv[i], "--fast-boot") == 0) {
+      fast = true;
+    }
+    else if (strcmp(argv[i], "--verify-boot") == 0) {
+      verify = true;
+    }
+    else if (strcmp(argv[i], "--cgb") == 0) {
+      model = MODEL_CGB;
+    }
+    else if (strcmp(argv[i], "--frame-skip") == 0 && i + 1 < argc) {
+      i++;
+      frameSkip = strcmp(argv[i], "all") == 0 ? FRAME_SKIP_ALL : atoi(argv[i]);
+    }
+    else if (strcmp(argv[i], "--render-thread") == 0) {
+      renderThread = true;
+    }
+    else if (strcmp(argv[i], "--video") == 0 && i + 1 < argc) {
+      videoPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--audio") == 0 && i + 1 < argc) {
+      audioPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--direct") == 0) {
+      direct = true;
+    }
+    else if (strcmp(argv[i], "--cheat") == 0 && i + 1 < argc &&
+	     cheatCount < MAX_PATCHES + MAX_FREEZES) {
+      cheats[cheatCount++] = argv[++i];
+    }
+    else if (strcmp(argv[i], "--sav") == 0 && i + 1 < argc) {
+      savePath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--sync-frames") == 0 && i + 1 < argc) {
+      syncInterval = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+      metricsPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--metrics-frames") == 0 && i + 1 < argc) {
+      metricsInterval = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = atol(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--aot") == 0) {
+      compiled = true;
+    }
+    else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      recordPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+      inputPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--keyframes") == 0 && i + 1 < argc) {
+      keyframeInterval = atol(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+      playPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+      seekFrame = atol(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--until") == 0 && i + 1 < argc) {
+      if (!addUntil(argv[++i])) {
+	return 1;
+      }
+    }
+    else if (argv[i][0] != '-' && romPath == NULL) {
+      romPath = argv[i];
+    }
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (verify && model == MODEL_CGB) {
+    printf("Error: --verify-boot only checks the DMG boot ROM\n");
+    return 1;
+  }
+
+  registerMetrics();
+  if (metricsPath != NULL) {
+    startMetricsExport(metricsPath);
+  }
+
+  if (romPath != NULL && !loadROM(romPath)) {
+    return 1;
+  }
+  if (savePath != NULL && !openBatteryRAM(savePath)) {
+    return 1;
+  }
+  if (compiled && !initializeAOT()) {
+    return 1;
+  }
+
+  if (verify) {
+    if (!verifyBoot(model)) {
+      printf("Warning: fast boot state differs from the boot ROM\n");
+    }
+  }
+  else if (fast) {
+    fastBoot(model);
+  }
+  else {
+    resetMachine();
+  }
+  for (i = 0; i < cheatCount; i++) {
+    if (!addCheat(cheats[i])) {
+      return 1;
+    }
+  }
+  if (sharedName != NULL && !openSharedMemory(sharedName)) {
+    return 1;
+  }
+  if ((videoPath != NULL || audioPath != NULL) && !startCapture(videoPath, audioPath, direct)) {
+    return 1;
+  }
+  if (renderThread && !debug && !startPipeline()) { // the debugger wants lines drawn as they happen
+    return 1;
+  }
+
+  if (debug) {
+    debugger();
+  }
+  else if (recordPath != NULL) {
+    // one hex joypad byte per line, frames past the end of the file get none
+    FILE *input = inputPath != NULL ? fopen(inputPath, "r") : NULL;
+    unsigned int buttons;
+    if (frames < 0) {
+      frames = 60;
+    }
+    if (!startRecording(recordPath, keyframeInterval)) {
+      return 1;
+    }
+    for (i = 0; i < frames; i++) {
+      if (input == NULL || fscanf(input, "%x", &buttons) != 1) {
+	buttons = 0;
+      }
+      recordMovieFrame(buttons);
+    }
+    stopRecording();
+    if (input != NULL) {
+      fclose(input);
+    }
+  }
+  else if (playPath != NULL) {
+    if (!startPlayback(playPath) || !seekMovie(seekFrame)) {
+      return 1;
+    }
+    while (playMovieFrame()) {
+    }
+    stopPlayback();
+  }
+  else if (untilCount > 0) {
+    if (frames >= 0) { // --frames caps the run like frames=n
+      char limit[32];
+      snprintf(limit, sizeof(limit), "frames=%ld", frames);
+      addUntil(limit);
+    }
+    describeUntil(runUntil());
+  }
+  else if (frames >= 0) {
+    for (i = 0; i < frames; i++) {
+      if (compiled) {
+	runFrameAOT();
+      }
+      else {
+	runFrame();
+      }
+    }
+  }
+  else {
+    mainLoop();
+    endSharedFrame();
+  }
+
+  stopPipeline();
+  stopCapture();
+  if (metricsPath != NULL) {
+    writeMetricsFile(metricsPath);
+  }
+  printRegisters();
+  closeSharedMemory();
+  closeBatteryRAM();
 }
@@ -2,7 +2,26 @@
 #define GB_H_INCLUDED
 
 #include <stdio.h>
+#include "aot.h"
+#include "boot.h"
+#include "cartridge.h"
+#include "cgb.h"
+#include "cheats.h"
 #include "cpu.h"
+#include "debugger.h"
+#include "dma.h"
+#include "interrupts.h"
+#include "joypad.h"
 #include "memory.h"
+#include "metrics.h"
+#include "movie.h"
+#include "pipeline.h"
+#include "ppu.h"
+#include "render.h"
+#include "savestate.h"
+#include "scheduler.h"
+#include "shm.h"
+#include "timer.h"
+#include "until.h"
 
 #endif
@@ -0,0 +1,243 @@
+#define _GNU_SOURCE // memfd_create
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "instance.h"
+#include "dma.h"
+#include "interrupts.h"
+#include "pipeline.h"
+
+// Many machines running one cartridge in one process. The ROM is already
+// shared: rom is loaded once and switched banks are only pointers into it.
+// Everything writable is captured once, after boot, into a template arena
+// in a memfd, and each instance maps that MAP_PRIVATE. The kernel then
+// copies a page the first time an instance writes to it, so an instance
+// costs the pages it has dirtied; the ROM banks mirrored at 0x0000-0x7FFF
+// are never written and stay shared.
+//
+// An instance runs on the usual globals: enterInstance points memory and
+// sram at its arena and loads its registers, leaveInstance stores them back
+// and points memory and sram at what they were before. CGB banks are copied
+// in and out, so CGB instances always own that part of their arena.
+//
+// cloneInstance forks an instance within the process by copying the pages
+// it owns over a fresh view of the template; forkInstance is the
+// process-pool alternative and clones the whole process.
+
+uint8_t *ownerImage;
+uint8_t *ownerSram;
+
+void storeInstance(gbInstance *instance) {
+  saveCPUState(&instance->cpu);
+  instance->cycles = cycles;
+  instance->frameCount = frameCount;
+  instance->joypadSelect = joypadSelect;
+  instance->joypadButtons = joypadButtons;
+  instance->eiDelay = eiDelay;
+  instance->dmaActive = dmaActive;
+  instance->cgbMode = cgbMode;
+  instance->timer = timer;
+  instance->ppu = ppu;
+  instance->mbc = mbc;
+  memcpy(instance->eventCycle, eventCycle, sizeof(eventCycle));
+}
+
+// Snapshot the machine as it is now, normally just after fastBoot.
+bool createTemplate(instanceTemplate *template) {
+  if (sramMapped) {
+    printf("Error: instances cannot share a mapped save file\n");
+    return false;
+  }
+  template->size = ARENA_SRAM + sramSize;
+  template->fd = memfd_create("gb-template", MFD_CLOEXEC);
+  if (template->fd < 0 || ftruncate(template->fd, template->size) != 0) {
+    printf("Error: could not create instance template\n");
+    if (template->fd >= 0) {
+      close(template->fd);
+    }
+    return false;
+  }
+  if (pwrite(template->fd, memory, MEMORY_SIZE, 0) != MEMORY_SIZE ||
+      pwrite(template->fd, &cgb, sizeof(cgb), ARENA_CGB) != (ssize_t) sizeof(cgb) ||
+      (sramSize > 0 && pwrite(template->fd, sram, sramSize, ARENA_SRAM) != (ssize_t) sramSize)) {
+    printf("Error: could not write instance template\n");
+    close(template->fd);
+    return false;
+  }
+  memset(&template->start, 0, sizeof(template->start));
+  storeInstance(&template->start);
+  return true;
+}
+
+void freeTemplate(instanceTemplate *template) {
+  close(template->fd);
+  template->fd = -1;
+}
+
+bool createInstance(const instanceTemplate *template, gbInstance *instance) {
+  *instance = template->start;
+  instance->arenaSize = template->size;
+  instance->arena = mmap(NULL, template->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, template->fd, 0);
+  if (instance->arena == MAP_FAILED) {
+    printf("Error: could not map instance arena\n");
+    instance->arena = NULL;
+    return false;
+  }
+  return true;
+}
+
+void freeInstance(gbInstance *instance) {
+  if (instance->arena != NULL) {
+    munmap(instance->arena, instance->arenaSize);
+    instance->arena = NULL;
+  }
+}
+
+void enterInstance(gbInstance *instance) {
+  ownerImage = memory;
+  ownerSram = sram;
+
+  loadCPUState(&instance->cpu);
+  cycles = instance->cycles;
+  frameCount = instance->frameCount;
+  joypadSelect = instance->joypadSelect;
+  joypadButtons = instance->joypadButtons;
+  eiDelay = instance->eiDelay;
+  dmaActive = instance->dmaActive;
+  cgbMode = instance->cgbMode;
+  timer = instance->timer;
+  ppu = instance->ppu;
+  mbc = instance->mbc;
+  if (cgbMode) {
+    memcpy(&cgb, instance->arena + ARENA_CGB, sizeof(cgb));
+  }
+  cycleShift = cgb.doubleSpeed;
+  memcpy(eventCycle, instance->eventCycle, sizeof(eventCycle));
+  updateNextEvent();
+  updateInterrupts();
+
+  sram = sramSize > 0 ? instance->arena + ARENA_SRAM : NULL;
+  memory = instance->arena;
+  mapMemoryImage();
+  syncPipeline();
+}
+
+void leaveInstance(gbInstance *instance) {
+  flushPipeline();
+  storeInstance(instance);
+  if (cgbMode) {
+    memcpy(instance->arena + ARENA_CGB, &cgb, sizeof(cgb));
+  }
+  sram = ownerSram;
+  memory = ownerImage;
+  mapMemoryImage();
+}
+
+// Which pages of the arena this instance has its own copy of: present or
+// swapped but no longer the memfd's, read from /proc/self/pagemap. Returns
+// the page count, or 0 if pagemap could not be read.
+size_t ownedPages(const gbInstance *instance, bool *owned) {
+  static int pagemap = -1;
+  uint64_t entries[ARENA_PAGES];
+  size_t pages = (instance->arenaSize + ARENA_PAGE - 1) / ARENA_PAGE;
+  size_t i;
+
+  if (pagemap < 0) {
+    pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  }
+  if (pagemap < 0 || pages > ARENA_PAGES || sysconf(_SC_PAGESIZE) != ARENA_PAGE ||
+      pread(pagemap, entries, pages * sizeof(uint64_t),
+	    (uintptr_t) instance->arena / ARENA_PAGE * sizeof(uint64_t)) != (ssize_t) (pages * sizeof(uint64_t))) {
+    return 0;
+  }
+  for (i = 0; i < pages; i++) {
+    bool mapped = (entries[i] >> 63 & 1) || (entries[i] >> 62 & 1); // present or swapped
+    bool filePage = entries[i] >> 61 & 1;
+    owned[i] = mapped && !filePage;
+  }
+  return pages;
+}
+
+// Bytes of the arena this instance has its own copy of.
+size_t instanceResidentBytes(const gbInstance *instance) {
+  bool owned[ARENA_PAGES];
+  size_t pages = ownedPages(instance, owned);
+  size_t resident = 0;
+  size_t i;
+
+  for (i = 0; i < pages; i++) {
+    if (owned[i]) {
+      resident += ARENA_PAGE;
+    }
+  }
+  return resident;
+}
+
+// A new instance in the same state as source, which may be the one entered.
+// It maps the template afresh and copies only the pages source owns, so the
+// cost is the pages source has dirtied since the template, not the arena.
+bool cloneInstance(const instanceTemplate *template, gbInstance *source, gbInstance *clone) {
+  bool owned[ARENA_PAGES];
+  size_t pages, i;
+
+  if (memory == source->arena) { // running: bring its registers and CGB banks up to date
+    flushPipeline();
+    storeInstance(source);
+    if (cgbMode) {
+      memcpy(source->arena + ARENA_CGB, &cgb, sizeof(cgb));
+    }
+  }
+  pages = ownedPages(source, owned);
+  if (pages == 0 || !createInstance(template, clone)) {
+    printf("Error: could not clone instance\n");
+    return false;
+  }
+
+  uint8_t *arena = clone->arena;
+  *clone = *source;
+  clone->arena = arena;
+  for (i = 0; i < pages; i++) {
+    if (owned[i]) {
+      memcpy(arena + i * ARENA_PAGE, source->arena + i * ARENA_PAGE,
+	     i * ARENA_PAGE + ARENA_PAGE > clone->arenaSize ? clone->arenaSize - i * ARENA_PAGE : ARENA_PAGE);
+    }
+  }
+  return true;
+}
+
+// Process-pool cloning: fork, and the child carries on as an independent
+// copy of the machine. The kernel shares every page copy-on-write, so past
+// the page tables a clone costs only what either side dirties afterwards.
+// Returns what fork returns.
+pid_t forkInstance() {
+  flushPipeline();
+  if (pipelineActive) { // the render thread does not survive fork
+    printf("Error: cannot fork with the render thread running\n");
+    return -1;
+  }
+  fflush(stdout);
+  return fork();
+}
+
+// Exact equality of two stored instances, for a stateSet. The arenas are
+// compared whole, so this also covers what hashState leaves out: CGB and
+// cartridge RAM banks that are not mapped.
+bool sameInstance(const void *first, const void *second) {
+  const gbInstance *a = first;
+  const gbInstance *b = second;
+
+  return memcmp(&a->cpu, &b->cpu, sizeof(a->cpu)) == 0 && a->cycles == b->cycles &&
+    a->frameCount == b->frameCount && a->joypadSelect == b->joypadSelect &&
+    a->joypadButtons == b->joypadButtons && a->eiDelay == b->eiDelay && a->dmaActive == b->dmaActive &&
+    a->cgbMode == b->cgbMode && a->timer.divBase == b->timer.divBase &&
+    a->timer.timaBase == b->timer.timaBase && a->timer.timaValue == b->timer.timaValue &&
+    a->ppu.mode == b->ppu.mode && a->ppu.line == b->ppu.line && a->ppu.windowLine == b->ppu.windowLine &&
+    a->ppu.statLine == b->ppu.statLine && a->ppu.rendering == b->ppu.rendering &&
+    a->ppu.renderRequested == b->ppu.renderRequested && a->ppu.skipCounter == b->ppu.skipCounter &&
+    a->ppu.frames == b->ppu.frames && a->ppu.renderedFrames == b->ppu.renderedFrames &&
+    a->mbc.type == b->mbc.type && a->mbc.romBank == b->mbc.romBank && a->mbc.ramBank == b->mbc.ramBank &&
+    a->mbc.bankHigh == b->mbc.bankHigh && a->mbc.mode == b->mbc.mode && a->mbc.ramEnabled == b->mbc.ramEnabled &&
+    memcmp(a->eventCycle, b->eventCycle, sizeof(a->eventCycle)) == 0 && a->arenaSize == b->arenaSize &&
+    memcmp(a->arena, b->arena, a->arenaSize) == 0;
+}
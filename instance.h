@@ -0,0 +1,54 @@
+#ifndef INSTANCE_H_INCLUDED
+#define INSTANCE_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "savestate.h"
+
+// Arena layout: the memory image, the CGB banks, then cartridge RAM, each
+// starting on a page so untouched parts stay shared.
+#define ARENA_PAGE 0x1000
+#define ARENA_CGB MEMORY_SIZE
+#define ARENA_SRAM (ARENA_CGB + ((sizeof(cgbState) + ARENA_PAGE - 1) & ~(size_t) (ARENA_PAGE - 1)))
+#define ARENA_PAGES ((ARENA_SRAM + 0x20000) / ARENA_PAGE) // with the largest cartridge RAM
+
+// One machine of many sharing a cartridge: its registers here, its memory
+// in a private mapping of the template's arena.
+typedef struct {
+  cpuState cpu;
+  uint64_t cycles;
+  uint64_t frameCount;
+  uint8_t joypadSelect;
+  uint8_t joypadButtons;
+  uint8_t eiDelay;
+  bool dmaActive;
+  bool cgbMode;
+  timerState timer;
+  ppuState ppu;
+  mbcState mbc;
+  uint64_t eventCycle[EVENT_COUNT];
+  uint8_t *arena;
+  size_t arenaSize;
+} gbInstance;
+
+// The state every instance starts from, held in a memfd.
+typedef struct {
+  int fd;
+  size_t size;
+  gbInstance start;
+} instanceTemplate;
+
+bool createTemplate(instanceTemplate *);
+void freeTemplate(instanceTemplate *);
+bool createInstance(const instanceTemplate *, gbInstance *);
+void freeInstance(gbInstance *);
+void enterInstance(gbInstance *);
+void leaveInstance(gbInstance *);
+size_t instanceResidentBytes(const gbInstance *);
+bool cloneInstance(const instanceTemplate *, gbInstance *, gbInstance *);
+pid_t forkInstance(void);
+bool sameInstance(const void *, const void *);
+
+#endif
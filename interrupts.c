@@ -0,0 +1,43 @@
+#include "interrupts.h"
+#include "cpu.h"
+
+uint8_t interruptSignal;
+uint8_t eiDelay;
+
+void initializeInterrupts() {
+  memory[0xFF0F] = 0xE0; // IF, upper bits read as 1
+  memory[0xFFFF] = 0x00; // IE
+  eiDelay = 0;
+  updateInterrupts();
+}
+
+void updateInterrupts() {
+  uint8_t pending = memory[0xFFFF] & memory[0xFF0F] & 0x1F;
+  interruptSignal = (interruptsEnabled && pending) || eiDelay;
+}
+
+void requestInterrupt(uint8_t interrupt) {
+  memory[0xFF0F] |= interrupt;
+  updateInterrupts();
+}
+
+// Called after an instruction whenever interruptSignal is set.
+void serviceInterrupts() {
+  // EI takes effect after the instruction that follows it
+  if (eiDelay && --eiDelay == 0) {
+    interruptsEnabled = true;
+  }
+
+  uint8_t pending = memory[0xFFFF] & memory[0xFF0F] & 0x1F;
+  if (interruptsEnabled && pending && !prefixCB) {
+    int bit = __builtin_ctz(pending);
+    memory[0xFF0F] &= ~(1 << bit);
+    metrics.interrupts[bit]++;
+    interruptsEnabled = false;
+    pushWord(pc);
+    pc = 0x40 + bit * 8;
+    cycles += 20 >> cycleShift;
+  }
+
+  updateInterrupts();
+}
@@ -0,0 +1,24 @@
+#ifndef INTERRUPTS_H_INCLUDED
+#define INTERRUPTS_H_INCLUDED
+
+#include <stdint.h>
+
+// IF/IE bits, lowest bit has the highest priority
+#define INT_VBLANK 0x01
+#define INT_STAT   0x02
+#define INT_TIMER  0x04
+#define INT_SERIAL 0x08
+#define INT_JOYPAD 0x10
+
+// Nonzero when the CPU loop has interrupt work to do: an enabled interrupt
+// is pending with IME set, or an EI is waiting to take effect. Recomputed
+// only when IF, IE or IME change.
+extern uint8_t interruptSignal;
+extern uint8_t eiDelay;
+
+void initializeInterrupts(void);
+void updateInterrupts(void);
+void requestInterrupt(uint8_t);
+void serviceInterrupts(void);
+
+#endif
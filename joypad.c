@@ -0,0 +1,37 @@
+#include "joypad.h"
+#include "interrupts.h"
+
+uint8_t joypadSelect;
+uint8_t joypadButtons;
+
+void initializeJoypad() {
+  joypadSelect = 0x30;
+  joypadButtons = 0;
+  updateJoypad();
+}
+
+// P1 is recomputed whenever the select bits or the buttons change, so
+// reading 0xFF00 stays a plain memory read.
+void updateJoypad() {
+  uint8_t pressed = 0;
+  if (!(joypadSelect & 0x10)) {
+    pressed |= joypadButtons & 0x0F; // directions
+  }
+  if (!(joypadSelect & 0x20)) {
+    pressed |= joypadButtons >> 4; // A, B, Select, Start
+  }
+  memory[0xFF00] = 0xC0 | joypadSelect | (~pressed & 0x0F);
+}
+
+void writeJoypad(uint8_t value) {
+  joypadSelect = value & 0x30;
+  updateJoypad();
+}
+
+void setJoypad(uint8_t buttons) {
+  if (buttons & ~joypadButtons) {
+    requestInterrupt(INT_JOYPAD);
+  }
+  joypadButtons = buttons;
+  updateJoypad();
+}
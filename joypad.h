@@ -0,0 +1,25 @@
+#ifndef JOYPAD_H_INCLUDED
+#define JOYPAD_H_INCLUDED
+
+#include <stdint.h>
+#include "memory.h"
+
+// bit set = button held
+#define BUTTON_RIGHT  0x01
+#define BUTTON_LEFT   0x02
+#define BUTTON_UP     0x04
+#define BUTTON_DOWN   0x08
+#define BUTTON_A      0x10
+#define BUTTON_B      0x20
+#define BUTTON_SELECT 0x40
+#define BUTTON_START  0x80
+
+extern uint8_t joypadSelect;
+extern uint8_t joypadButtons;
+
+void initializeJoypad(void);
+void updateJoypad(void);
+void writeJoypad(uint8_t);
+void setJoypad(uint8_t);
+
+#endif
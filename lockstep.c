@@ -0,0 +1,400 @@
+#include "lockstep.h"
+#include "interrupts.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+typedef enum { VEC_NONE, VEC_NOP, VEC_LD_IMM, VEC_LD_REG, VEC_INC, VEC_DEC,
+	       VEC_AND, VEC_XOR, VEC_OR, VEC_JR } vectorKind;
+
+// Opcodes the vector path executes for all lanes at once. Each entry must
+// match what executeOpcode does for the same opcode; everything else goes
+// through executeOpcode one lane at a time.
+typedef struct {
+  uint8_t kind;
+  uint8_t dst;
+  uint8_t src;
+  uint8_t flagMask; // JR is taken when (F & flagMask) == flagValue
+  uint8_t flagValue;
+} vectorOp;
+
+vectorOp vectorOps[256];
+bool vectorOpsBuilt = false;
+
+// register operand encoded in the low three bits of most opcodes, 0xFF for (HL)
+const uint8_t operandRegister[8] = { REG_B, REG_C, REG_D, REG_E, REG_H, REG_L, 0xFF, REG_A };
+
+void buildVectorOps() {
+  int i;
+
+  vectorOps[0x00].kind = VEC_NOP;
+
+  for (i = 0; i < 8; i++) {
+    uint8_t reg = operandRegister[i];
+    if (reg == 0xFF) {
+      continue;
+    }
+
+    vectorOps[0x06 + 8 * i] = (vectorOp) { VEC_LD_IMM, reg, 0, 0, 0 };
+    vectorOps[0x05 + 8 * i] = (vectorOp) { VEC_DEC, reg, 0, 0, 0 };
+    if (reg != REG_A) {
+      vectorOps[0x04 + 8 * i] = (vectorOp) { VEC_INC, reg, 0, 0, 0 };
+    }
+    vectorOps[0xA0 + i] = (vectorOp) { VEC_AND, REG_A, reg, 0, 0 };
+    vectorOps[0xA8 + i] = (vectorOp) { VEC_XOR, REG_A, reg, 0, 0 };
+    vectorOps[0xB0 + i] = (vectorOp) { VEC_OR, REG_A, reg, 0, 0 };
+  }
+
+  for (i = 0x40; i < 0x80; i++) {
+    uint8_t dst = operandRegister[(i >> 3) & 7];
+    uint8_t src = operandRegister[i & 7];
+    if (dst != 0xFF && src != 0xFF) {
+      vectorOps[i] = (vectorOp) { VEC_LD_REG, dst, src, 0, 0 };
+    }
+  }
+
+  vectorOps[0x18] = (vectorOp) { VEC_JR, 0, 0, 0x00, 0x00 };
+  vectorOps[0x20] = (vectorOp) { VEC_JR, 0, 0, 0x80, 0x00 };
+  vectorOps[0x30] = (vectorOp) { VEC_JR, 0, 0, 0x10, 0x00 };
+  vectorOps[0x38] = (vectorOp) { VEC_JR, 0, 0, 0x10, 0x10 };
+
+  vectorOpsBuilt = true;
+}
+
+// Give every lane a copy of the current page tables pointed at its own
+// image, so switching lanes is three pointer stores rather than a remap.
+// Cartridge RAM and CGB banks are shared, so their fast write entries are
+// dropped and writes there reach writeSlow, which faults the lane. Rebuilt
+// whenever refreshPages changes the emulator's own tables.
+void buildLaneTables(lockstepCore *core) {
+  uint8_t *image = getMemoryImage();
+  int lane, page;
+
+  for (lane = 0; lane < core->lanes; lane++) {
+    pageTables *tables = core->tables[lane];
+    uint8_t *own = core->memory[lane];
+    for (page = 0; page < 0x100; page++) {
+      tables->base[page] = pageBase[page];
+      tables->read[page] = readPage[page];
+      tables->write[page] = NULL;
+      if (pageBase[page] >= image && pageBase[page] < image + MEMORY_SIZE) {
+	tables->base[page] = own + (pageBase[page] - image);
+      }
+      if (readPage[page] >= image && readPage[page] < image + MEMORY_SIZE) {
+	tables->read[page] = own + (readPage[page] - image);
+      }
+      if (writePage[page] >= image && writePage[page] < image + MEMORY_SIZE) {
+	tables->write[page] = own + (writePage[page] - image);
+      }
+    }
+  }
+  core->tablesGeneration = pageGeneration;
+}
+
+void initializeLockstep(lockstepCore *core, int lanes) {
+  if (lanes < 1 || lanes > LOCKSTEP_LANES) {
+    printf("Error: lockstep core supports 1 to %d lanes, got %d\n", LOCKSTEP_LANES, lanes);
+    exit(1);
+  }
+  if (!vectorOpsBuilt) {
+    buildVectorOps();
+  }
+
+  memset(core, 0, sizeof(*core));
+  core->lanes = lanes;
+
+  // every lane starts from the same power-on state as a scalar instance
+  uint8_t *previousImage = getMemoryImage();
+  cpuState previousState, state;
+  saveCPUState(&previousState);
+  memset(&state, 0, sizeof(state));
+  loadCPUState(&state);
+  initializeCPU();
+  saveCPUState(&state);
+
+  int lane;
+  for (lane = 0; lane < lanes; lane++) {
+    core->memory[lane] = calloc(MEMORY_SIZE, 1);
+    core->tables[lane] = malloc(sizeof(pageTables));
+    if (core->memory[lane] == NULL || core->tables[lane] == NULL) {
+      printf("Error: could not allocate memory for lane %d\n", lane);
+      exit(1);
+    }
+    setMemoryImage(core->memory[lane]);
+    initializeMemory();
+    loadLane(core, lane, &state);
+  }
+
+  setMemoryImage(previousImage);
+  loadCPUState(&previousState);
+  buildLaneTables(core);
+}
+
+void freeLockstep(lockstepCore *core) {
+  int lane;
+  for (lane = 0; lane < core->lanes; lane++) {
+    free(core->memory[lane]);
+    free(core->tables[lane]);
+    core->memory[lane] = NULL;
+    core->tables[lane] = NULL;
+  }
+}
+
+void loadLane(lockstepCore *core, int lane, const cpuState *state) {
+  int reg;
+  core->pc[lane] = state->pc;
+  core->sp[lane] = state->sp;
+  for (reg = 0; reg < 8; reg++) {
+    core->registers[reg][lane] = state->registers[reg];
+  }
+  core->prefixCB[lane] = state->prefixCB;
+  core->interruptsEnabled[lane] = state->interruptsEnabled;
+}
+
+void storeLane(lockstepCore *core, int lane, cpuState *state) {
+  int reg;
+  state->pc = core->pc[lane];
+  state->sp = core->sp[lane];
+  for (reg = 0; reg < 8; reg++) {
+    state->registers[reg] = core->registers[reg][lane];
+  }
+  state->prefixCB = core->prefixCB[lane];
+  state->interruptsEnabled = core->interruptsEnabled[lane];
+}
+
+// Opcodes that wait on the events lanes do not have.
+const bool laneUnsupported[0x100] = {
+  [0x10] = true, [0x76] = true
+};
+
+// Run one instruction on a single lane through the reference interpreter.
+// The global CPU state, cycle counter and page tables are borrowed for the
+// duration. Instructions a lane cannot run alone fault it instead.
+void stepLane(lockstepCore *core, int lane) {
+  cpuState state;
+  uint8_t ownDelay = eiDelay;
+  uint8_t *ownImage = getMemoryImage();
+
+  if (core->faulted & (1 << lane)) {
+    return;
+  }
+  if (core->tablesGeneration != pageGeneration) {
+    buildLaneTables(core);
+  }
+  storeLane(core, lane, &state);
+  loadCPUState(&state);
+  usePageTables(core->tables[lane], core->memory[lane]);
+  cycles = core->cycles[lane];
+  eiDelay = core->eiDelay[lane];
+
+  laneIsolated = true;
+  laneFault = false;
+  uint8_t opcode = readNextByte();
+  if (!prefixCB && laneUnsupported[opcode]) {
+    laneFault = true;
+  }
+  else {
+    executeOpcode(opcode);
+  }
+  laneIsolated = false;
+  usePageTables(NULL, ownImage);
+
+  if (laneFault) {
+    core->faulted |= 1 << lane;
+    eiDelay = ownDelay;
+    return;
+  }
+  core->eiDelay[lane] = eiDelay;
+  eiDelay = ownDelay;
+  core->cycles[lane] = cycles;
+  saveCPUState(&state);
+  loadLane(core, lane, &state);
+  core->scalarSteps++;
+}
+
+#ifdef __AVX2__
+
+// bitmask of lanes whose pc equals address
+uint16_t lanesAt(const lockstepCore *core, uint16_t address) {
+  __m256i pcs = _mm256_load_si256((const __m256i *) core->pc);
+  __m256i equal = _mm256_cmpeq_epi16(pcs, _mm256_set1_epi16(address));
+  __m128i packed = _mm_packs_epi16(_mm256_castsi256_si128(equal),
+				   _mm256_extracti128_si256(equal, 1));
+  return (uint16_t) _mm_movemask_epi8(packed);
+}
+
+// expand a lane bitmask to 0xFF/0x00 per byte lane
+__m128i laneMask(uint16_t lanes) {
+  const __m128i spread = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1);
+  const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  __m128i bytes = _mm_shuffle_epi8(_mm_cvtsi32_si128(lanes), spread);
+  return _mm_cmpeq_epi8(_mm_and_si128(bytes, bits), bits);
+}
+
+void executeVector(lockstepCore *core, uint16_t lanes, const vectorOp *op, uint8_t opcode, uint8_t operand) {
+  __m128i *regs = (__m128i *) core->registers;
+  __m128i mask = laneMask(lanes);
+  __m128i zero = _mm_setzero_si128();
+  __m128i flags = _mm_load_si128(&regs[REG_F]);
+  __m128i value, result, isZero, newFlags;
+  __m256i offset = _mm256_setzero_si256();
+  uint16_t taken = 0;
+
+  switch (op->kind) {
+  case VEC_NOP:
+    break;
+  case VEC_LD_IMM:
+    regs[op->dst] = _mm_blendv_epi8(regs[op->dst], _mm_set1_epi8(operand), mask);
+    break;
+  case VEC_LD_REG:
+    regs[op->dst] = _mm_blendv_epi8(regs[op->dst], regs[op->src], mask);
+    break;
+  case VEC_INC:
+  case VEC_DEC:
+    value = regs[op->dst];
+    if (op->kind == VEC_INC) {
+      result = _mm_add_epi8(value, _mm_set1_epi8(1));
+      newFlags = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(value, _mm_set1_epi8(0x0F)),
+					      _mm_set1_epi8(0x0F)), _mm_set1_epi8(0x20));
+    }
+    else {
+      result = _mm_sub_epi8(value, _mm_set1_epi8(1));
+      newFlags = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(value, _mm_set1_epi8(0x0F)), zero),
+			       _mm_set1_epi8(0x20));
+      newFlags = _mm_or_si128(newFlags, _mm_set1_epi8(0x40));
+    }
+    isZero = _mm_cmpeq_epi8(result, zero);
+    newFlags = _mm_or_si128(newFlags, _mm_and_si128(isZero, _mm_set1_epi8((char) 0x80)));
+    newFlags = _mm_or_si128(newFlags, _mm_and_si128(flags, _mm_set1_epi8(0x1F)));
+    regs[op->dst] = _mm_blendv_epi8(value, result, mask);
+    regs[REG_F] = _mm_blendv_epi8(flags, newFlags, mask);
+    break;
+  case VEC_AND:
+  case VEC_XOR:
+  case VEC_OR:
+    value = regs[REG_A];
+    if (op->kind == VEC_AND) {
+      result = _mm_and_si128(value, regs[op->src]);
+    }
+    else if (op->kind == VEC_XOR) {
+      result = _mm_xor_si128(value, regs[op->src]);
+    }
+    else {
+      result = _mm_or_si128(value, regs[op->src]);
+    }
+    // Z is only ever set here, never cleared; N, H and C are overwritten
+    isZero = _mm_cmpeq_epi8(result, zero);
+    newFlags = _mm_and_si128(flags, _mm_set1_epi8((char) 0x8F));
+    newFlags = _mm_or_si128(newFlags, _mm_and_si128(isZero, _mm_set1_epi8((char) 0x80)));
+    if (op->kind == VEC_AND) {
+      newFlags = _mm_or_si128(newFlags, _mm_set1_epi8(0x20));
+    }
+    regs[REG_A] = _mm_blendv_epi8(value, result, mask);
+    regs[REG_F] = _mm_blendv_epi8(flags, newFlags, mask);
+    break;
+  case VEC_JR: {
+    __m128i branch = _mm_cmpeq_epi8(_mm_and_si128(flags, _mm_set1_epi8(op->flagMask)),
+				    _mm_set1_epi8(op->flagValue));
+    offset = _mm256_and_si256(_mm256_cvtepi8_epi16(branch), _mm256_set1_epi16(operand));
+    // unconditional JR already has the taken time in opcodeCycles
+    if (op->flagMask) {
+      taken = (uint16_t) _mm_movemask_epi8(branch);
+    }
+    break;
+  }
+  }
+
+  __m256i pcs = _mm256_load_si256((const __m256i *) core->pc);
+  __m256i step = _mm256_add_epi16(_mm256_set1_epi16(opcodeLength[opcode]), offset);
+  step = _mm256_and_si256(step, _mm256_cvtepi8_epi16(mask));
+  _mm256_store_si256((__m256i *) core->pc, _mm256_add_epi16(pcs, step));
+
+  while (lanes) {
+    int lane = __builtin_ctz(lanes);
+    core->cycles[lane] += opcodeCycles[opcode] + ((taken >> lane) & 1) * 4;
+    lanes &= lanes - 1;
+  }
+}
+
+// Try to run the instruction at the leader's pc for every lane in the group.
+// Returns the lanes that still need the scalar path.
+uint16_t stepVector(lockstepCore *core, int leader, uint16_t group) {
+  if ((group & (group - 1)) == 0) {
+    return group;
+  }
+
+  // code in slow-path pages (I/O, DMA lockout) goes through readMemory
+  uint16_t address = core->pc[leader];
+  if (readPage[address >> 8] == NULL || readPage[(uint16_t) (address + 1) >> 8] == NULL) {
+    return group;
+  }
+  uint8_t opcode = core->memory[leader][address];
+  const vectorOp *op = &vectorOps[opcode];
+  if (op->kind == VEC_NONE) {
+    return group;
+  }
+
+  uint8_t length = opcodeLength[opcode];
+  uint16_t operandAddress = address + 1;
+  uint8_t operand = length >= 2 ? core->memory[leader][operandAddress] : 0;
+
+  // lanes share a pc but not necessarily the code at it
+  uint16_t matching = 0;
+  uint16_t remaining = group;
+  while (remaining) {
+    int lane = __builtin_ctz(remaining);
+    remaining &= remaining - 1;
+    if (!core->prefixCB[lane] && core->memory[lane][address] == opcode &&
+	(length < 2 || core->memory[lane][operandAddress] == operand)) {
+      matching |= 1 << lane;
+    }
+  }
+  if ((matching & (matching - 1)) == 0) {
+    return group;
+  }
+
+  executeVector(core, matching, op, opcode, operand);
+  core->vectorSteps += __builtin_popcount(matching);
+  return group & ~matching;
+}
+
+#else
+
+uint16_t lanesAt(const lockstepCore *core, uint16_t address) {
+  uint16_t lanes = 0;
+  int lane;
+  for (lane = 0; lane < core->lanes; lane++) {
+    if (core->pc[lane] == address) {
+      lanes |= 1 << lane;
+    }
+  }
+  return lanes;
+}
+
+#endif
+
+// Retire one instruction on every lane. Lanes that share a pc run the
+// opcode together when the vector path supports it; diverged lanes and
+// unsupported opcodes fall back to executeOpcode per lane.
+void stepLockstep(lockstepCore *core) {
+  uint16_t pending = (uint16_t) ((1u << core->lanes) - 1) & ~core->faulted;
+
+  while (pending) {
+    int leader = __builtin_ctz(pending);
+    uint16_t group = lanesAt(core, core->pc[leader]) & pending;
+    pending &= ~group;
+
+#ifdef __AVX2__
+    group = stepVector(core, leader, group);
+#endif
+
+    while (group) {
+      int lane = __builtin_ctz(group);
+      group &= group - 1;
+      stepLane(core, lane);
+    }
+  }
+
+  updateInterrupts(); // EI and DI on a lane recomputed it from the lane's image
+}
@@ -0,0 +1,46 @@
+#ifndef LOCKSTEP_H_INCLUDED
+#define LOCKSTEP_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "memory.h"
+
+#define LOCKSTEP_LANES 16
+
+// Register file for up to LOCKSTEP_LANES instances in structure-of-arrays
+// layout, so one vector register holds the same register of every lane.
+//
+// A lane is a CPU and a memory image, nothing more: timers, events, DMA,
+// the PPU and the cartridge stay global and are never run per lane, and
+// interrupts are never taken (EI and DI only change the lane's own IME
+// state). A lane that reaches HALT or STOP, or writes anywhere but its own
+// RAM and plain I/O registers, is stopped with its registers as before that
+// instruction and its bit set in faulted. Only code that keeps to plain
+// memory, e.g. the start of the boot ROM, runs correctly.
+typedef struct {
+  uint16_t pc[LOCKSTEP_LANES] __attribute__((aligned(32)));
+  uint16_t sp[LOCKSTEP_LANES] __attribute__((aligned(32)));
+  uint8_t registers[8][LOCKSTEP_LANES] __attribute__((aligned(16)));
+  bool prefixCB[LOCKSTEP_LANES];
+  bool interruptsEnabled[LOCKSTEP_LANES];
+  uint8_t eiDelay[LOCKSTEP_LANES];
+  uint64_t cycles[LOCKSTEP_LANES];
+  uint8_t *memory[LOCKSTEP_LANES];
+  pageTables *tables[LOCKSTEP_LANES];
+  uint32_t tablesGeneration; // pageGeneration the lane tables were built from
+  int lanes;
+  uint16_t faulted;
+
+  uint64_t vectorSteps; // lane-instructions retired by the vector path
+  uint64_t scalarSteps; // lane-instructions retired through executeOpcode
+} lockstepCore;
+
+void initializeLockstep(lockstepCore *, int);
+void freeLockstep(lockstepCore *);
+void loadLane(lockstepCore *, int, const cpuState *);
+void storeLane(lockstepCore *, int, cpuState *);
+void stepLane(lockstepCore *, int);
+void stepLockstep(lockstepCore *);
+
+#endif
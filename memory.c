@@ -1,6 +1,43 @@
 #include "memory.h"
+#include "cartridge.h"
+#include "cgb.h"
+#include "cheats.h"
+#include "debugger.h"
+#include "dma.h"
+#include "interrupts.h"
+#include "joypad.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "ppu.h"
+#include "render.h"
+#include "statehash.h"
+#include "timer.h"
+#include "until.h"
 
-uint8_t memory[0xFFFF];
+uint8_t memoryImage[MEMORY_SIZE];
+uint8_t *memory = memoryImage;
+bool traceEnabled = true;
+// Set while a lockstep lane runs: writes that would reach state the lanes
+// share are dropped and flagged in laneFault (see laneWritable).
+bool laneIsolated = false;
+bool laneFault = false;
+
+// The address space in 256-byte pages. pageBase is where each page lives;
+// readPage and writePage are what the CPU goes through and are NULL for
+// pages that need the slow path (I/O, or everything but HRAM during DMA).
+// They point into ownPages except while a lockstep lane runs on its own set.
+pageTables ownPages;
+uint8_t **pageBase = ownPages.base;
+uint8_t **readPage = ownPages.read;
+uint8_t **writePage = ownPages.write;
+// Read-only replacements for pages of pageBase, e.g. cheat-patched ROM.
+uint8_t *patchPage[0x100];
+// Pages whose writes go to the cartridge instead, i.e. MBC registers over
+// ROM and cartridge RAM while it is disabled.
+bool readOnlyPage[0x100];
+// Bumped whenever refreshPages rebuilds the tables, so copies of them can
+// tell they are stale.
+uint32_t pageGeneration = 0;
 
 const uint8_t bios[] = {
   0x31, 0xFE, 0xFF, 0xAF, 0x21, 0xFF, 0x9F, 0x32, 0xCB, 0x7C, 0x20, 0xFB, 0x21, 0x26, 0xFF, 0x0E,
@@ -23,20 +60,223 @@ const uint8_t bios[] = {
 
 void initializeMemory() {
   memcpy(memory, bios, 256);
+  mapMemoryImage();
+}
+
+// Point the emulated address space at another image, e.g. one lane of the
+// lockstep core. The image must be MEMORY_SIZE bytes.
+void setMemoryImage(uint8_t *image) {
+  if (image != memory) {
+    memory = image;
+    mapMemoryImage();
+  }
+}
+
+uint8_t *getMemoryImage() {
+  return memory;
+}
+
+void mapMemoryImage() {
+  int page;
+  for (page = 0; page < 0x100; page++) {
+    pageBase[page] = memory + (page << 8);
+  }
+  for (page = 0xE0; page < 0xFE; page++) { // echo RAM mirrors 0xC000-0xDDFF
+    pageBase[page] = memory + ((page - 0x20) << 8);
+  }
+  mapBanks();
+  mapCartridge();
+  refreshPatches();
+  invalidateSprites();
+}
+
+// Run on image through tables already built for it, or on the emulator's
+// own tables when tables is NULL. Nothing is remapped; see lockstep.c.
+void usePageTables(pageTables *tables, uint8_t *image) {
+  if (tables == NULL) {
+    tables = &ownPages;
+  }
+  pageBase = tables->base;
+  readPage = tables->read;
+  writePage = tables->write;
+  memory = image;
+}
+
+// Rebuild the fast tables after pageBase, a lockout or a watchpoint changed.
+void refreshPages() {
+  int page;
+
+  pageGeneration++;
+  if (dmaActive) {
+    memset(readPage, 0, 0x100 * sizeof(readPage[0]));
+    memset(writePage, 0, 0x100 * sizeof(writePage[0]));
+    return;
+  }
+  memcpy(readPage, pageBase, 0x100 * sizeof(readPage[0]));
+  memcpy(writePage, pageBase, 0x100 * sizeof(writePage[0]));
+  readPage[0xFF] = NULL;
+  writePage[0xFF] = NULL;
+  writePage[0xFE] = NULL; // OAM, for the sprite table
+  for (page = 0; page < 0x100; page++) {
+    if (patchPage[page] != NULL) {
+      readPage[page] = patchPage[page];
+    }
+    if (readOnlyPage[page]) {
+      writePage[page] = NULL;
+    }
+    if (watchPages[page] & WATCH_READ) {
+      readPage[page] = NULL;
+    }
+    if (watchPages[page] & WATCH_WRITE) {
+      writePage[page] = NULL;
+    }
+    if (hasher != NULL) {
+      if (hasher->base[page] != pageBase[page]) { // remapped, e.g. a bank switch
+	hasher->dirty[page] = true;
+      }
+      if (!hasher->dirty[page]) {
+	writePage[page] = NULL;
+      }
+    }
+  }
+  if (pipelineActive) { // VRAM writes go to the render thread's journal
+    memset(writePage + 0x80, 0, 0x20 * sizeof(writePage[0]));
+  }
 }
 
 uint8_t readMemory(uint16_t address) {
-  return memory[address];
+  uint8_t *page = readPage[address >> 8];
+  if (page != NULL) {
+    metrics.reads[pageRegion[address >> 8]]++;
+    return page[address & 0xFF];
+  }
+  return readSlow(address);
 }
 
 void writeMemory(uint16_t address, uint8_t value) {
+  uint8_t *page = writePage[address >> 8];
+  if (page != NULL) {
+    metrics.writes[pageRegion[address >> 8]]++;
+    page[address & 0xFF] = value;
+    if (traceEnabled) {
+      printf("wrote 0x%02X to 0x%04X\n", value, address);
+    }
+    return;
+  }
+  writeSlow(address, value);
+}
+
+uint8_t readSlow(uint16_t address) {
+  metrics.reads[address >= 0xFF80 ? REGION_HRAM : pageRegion[address >> 8]]++;
+  if (watchPages[address >> 8] & WATCH_READ) {
+    checkWatchpoint(address, WATCH_READ);
+  }
+  if (address >= 0xFF80) { // HRAM, IE
+    return memory[address];
+  }
+  if (dmaActive) { // only HRAM is reachable during OAM DMA
+    return 0xFF;
+  }
+  if (address >= 0xFF04 && address <= 0xFF05) { // DIV, TIMA
+    return readTimer(address);
+  }
+  if (address < 0xFF00) {
+    uint8_t *page = patchPage[address >> 8];
+    if (page == NULL) {
+      page = pageBase[address >> 8];
+    }
+    return page[address & 0xFF];
+  }
+  return memory[address];
+}
+
+// What a lockstep lane may write on its own: VRAM, WRAM, OAM and HRAM in
+// its image, and I/O registers that writeSlow just stores. The registers
+// with handlers below, cartridge ROM and RAM, and CGB banks all live in
+// globals every lane shares.
+bool laneWritable(uint16_t address) {
+  if (address >= 0xFF00) {
+    return !(address == 0xFF00 || address == 0xFF02 || (address >= 0xFF04 && address <= 0xFF07) ||
+	     address == 0xFF0F || address == 0xFF40 || address == 0xFF41 || address == 0xFF44 ||
+	     address == 0xFF45 || address == 0xFF46 || address == 0xFF50 || address == 0xFFFF ||
+	     (cgbMode && (address == 0xFF4D || address == 0xFF4F || address == 0xFF70 ||
+			  (address >= 0xFF51 && address <= 0xFF55))));
+  }
+  const uint8_t *page = pageBase[address >> 8];
+  return (address >= 0xC000 || (address >= 0x8000 && address < 0xA000)) &&
+    page >= memory && page < memory + MEMORY_SIZE;
+}
+
+void writeSlow(uint16_t address, uint8_t value) {
+  if (laneIsolated && !laneWritable(address)) {
+    laneFault = true;
+    return;
+  }
+  metrics.writes[address >= 0xFF80 ? REGION_HRAM : pageRegion[address >> 8]]++;
+  if (address >= 0xFF00) {
+    metrics.ioWrites[address & 0xFF]++;
+  }
+  if (watchPages[address >> 8] & WATCH_WRITE) {
+    checkWatchpoint(address, WATCH_WRITE);
+  }
+  if (dmaActive && address < 0xFF80) {
+    return;
+  }
+  if (hasher != NULL) {
+    markPageDirty(address >> 8);
+  }
+
   if (address == 0xFF02) { // SC (serial transfer control)
     if (value == 0x81) {
-      printf("%c", readMemory(0xFF01)); // SB (serial transfer data)
+      uint8_t data = readMemory(0xFF01); // SB (serial transfer data)
+      printf("%c", data);
+      serialOutput(data);
+    }
+  }
+  else if (address == 0xFF00) { // P1 (joypad)
+    writeJoypad(value);
+  }
+  else if (address >= 0xFF04 && address <= 0xFF07) { // DIV, TIMA, TMA, TAC
+    writeTimer(address, value);
+  }
+  else if (address == 0xFF0F) { // IF
+    memory[address] = 0xE0 | value;
+    updateInterrupts();
+  }
+  else if (address == 0xFF40 || address == 0xFF41 || address == 0xFF44 || address == 0xFF45) {
+    writePPU(address, value); // LCDC, STAT, LY, LYC
+  }
+  else if (cgbMode && (address == 0xFF4D || address == 0xFF4F || address == 0xFF70 ||
+		       (address >= 0xFF51 && address <= 0xFF55))) {
+    writeCGB(address, value); // KEY1, VBK, SVBK, HDMA1-5
+  }
+  else if (address == 0xFF46) { // DMA
+    startDMA(value);
+  }
+  else if (address == 0xFFFF) { // IE
+    memory[address] = value;
+    updateInterrupts();
+  }
+  else if (readOnlyPage[address >> 8]) {
+    writeCartridge(address, value);
+  }
+  else if (address < 0xFF00) {
+    pageBase[address >> 8][address & 0xFF] = value;
+    if (address >= 0xFE00) {
+      invalidateSprites();
+    }
+    if (pipelineActive && pageBase[address >> 8] == memory + (address & 0xFF00) &&
+	((address >= 0x8000 && address < 0xA000) || address >= 0xFE00)) {
+      pipelineWrite(address, value);
     }
   }
   else {
     memory[address] = value;
-    printf("wrote 0x%02X to 0x%04X\n", value, address);
+    if (address == 0xFF50 && value) { // boot ROM disable
+      unmapBootROM();
+    }
+    if (traceEnabled) {
+      printf("wrote 0x%02X to 0x%04X\n", value, address);
+    }
   }
 }
@@ -1,12 +1,41 @@
 #ifndef MEMORY_H_INCLUDED
 #define MEMORY_H_INCLUDED
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
+#define MEMORY_SIZE 0x10000
+
+// One set of the tables behind pageBase, readPage and writePage.
+typedef struct {
+  uint8_t *base[0x100];
+  uint8_t *read[0x100];
+  uint8_t *write[0x100];
+} pageTables;
+
+extern uint8_t *memory;
+extern const uint8_t bios[];
+extern bool traceEnabled;
+extern bool laneIsolated;
+extern bool laneFault;
+extern uint8_t **pageBase;
+extern uint8_t **readPage;
+extern uint8_t **writePage;
+extern uint8_t *patchPage[0x100];
+extern bool readOnlyPage[0x100];
+extern uint32_t pageGeneration;
+
 void initializeMemory(void);
+void setMemoryImage(uint8_t *);
+uint8_t *getMemoryImage(void);
+void mapMemoryImage(void);
+void usePageTables(pageTables *, uint8_t *);
+void refreshPages(void);
 uint8_t readMemory(uint16_t);
 void writeMemory(uint16_t, uint8_t);
+uint8_t readSlow(uint16_t);
+void writeSlow(uint16_t, uint8_t);
 
 #endif
@@ -0,0 +1,159 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "metrics.h"
+#include "cpu.h"
+
+__thread metricsBlock metrics;
+
+// region of each 256-byte page; page 0xFF is split by the slow path
+const uint8_t pageRegion[0x100] = {
+  [0x00 ... 0x7F] = REGION_ROM,
+  [0x80 ... 0x9F] = REGION_VRAM,
+  [0xA0 ... 0xBF] = REGION_SRAM,
+  [0xC0 ... 0xFD] = REGION_WRAM,
+  [0xFE] = REGION_OAM,
+  [0xFF] = REGION_IO
+};
+
+const char *regionNames[REGION_COUNT] = { "rom", "vram", "sram", "wram", "oam", "io", "hram" };
+const char *interruptNames[5] = { "vblank", "stat", "timer", "serial", "joypad" };
+
+metricsBlock *threadMetrics[MAX_METRICS_THREADS];
+int metricsThreads = 0;
+metricsBlock retiredMetrics; // counts of threads that have unregistered
+pthread_mutex_t metricsLock = PTHREAD_MUTEX_INITIALIZER;
+
+const char *metricsPath = NULL;
+int metricsInterval = METRICS_INTERVAL;
+int framesSinceExport = 0;
+
+// Add the calling thread's block to the ones collectMetrics sums. Threads
+// that never register still count, they just are not exported. A thread
+// that registers must call unregisterMetrics before it exits.
+void registerMetrics() {
+  int i;
+
+  pthread_mutex_lock(&metricsLock);
+  for (i = 0; i < metricsThreads; i++) {
+    if (threadMetrics[i] == &metrics) {
+      break;
+    }
+  }
+  if (i == metricsThreads && metricsThreads < MAX_METRICS_THREADS) {
+    threadMetrics[metricsThreads++] = &metrics;
+  }
+  pthread_mutex_unlock(&metricsLock);
+}
+
+void addMetrics(metricsBlock *total, const metricsBlock *block) {
+  const uint64_t *source = (const uint64_t *) block;
+  uint64_t *sum = (uint64_t *) total;
+  int i;
+  for (i = 0; i < (int) (sizeof(metricsBlock) / sizeof(uint64_t)); i++) {
+    sum[i] += source[i];
+  }
+}
+
+// Fold the calling thread's counts into the retired total and drop its
+// block, which goes away with the thread.
+void unregisterMetrics() {
+  int i;
+
+  pthread_mutex_lock(&metricsLock);
+  for (i = 0; i < metricsThreads; i++) {
+    if (threadMetrics[i] == &metrics) {
+      addMetrics(&retiredMetrics, &metrics);
+      threadMetrics[i] = threadMetrics[--metricsThreads];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&metricsLock);
+}
+
+void collectMetrics(metricsSnapshot *snapshot) {
+  int i;
+
+  memset(snapshot, 0, sizeof(*snapshot));
+  snapshot->cycles = cycles;
+  snapshot->frames = frameCount;
+
+  pthread_mutex_lock(&metricsLock);
+  snapshot->counters = retiredMetrics;
+  for (i = 0; i < metricsThreads; i++) {
+    addMetrics(&snapshot->counters, threadMetrics[i]);
+  }
+  pthread_mutex_unlock(&metricsLock);
+}
+
+// Write the counters in Prometheus text format. The file is replaced with
+// a rename so a scraper never sees half of it.
+bool writeMetricsFile(const char *path) {
+  metricsSnapshot snapshot;
+  metricsBlock *m = &snapshot.counters;
+  char temporary[512];
+  int i;
+
+  snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+  FILE *file = fopen(temporary, "w");
+  if (file == NULL) {
+    printf("Error: could not write metrics to %s\n", temporary);
+    return false;
+  }
+
+  collectMetrics(&snapshot);
+  fprintf(file, "# TYPE gb_cycles_total counter\ngb_cycles_total %llu\n",
+	  (unsigned long long) snapshot.cycles);
+  fprintf(file, "# TYPE gb_frames_total counter\ngb_frames_total %llu\n",
+	  (unsigned long long) snapshot.frames);
+  fprintf(file, "# TYPE gb_instructions_total counter\ngb_instructions_total %llu\n",
+	  (unsigned long long) m->instructions);
+  fprintf(file, "# TYPE gb_halt_cycles_total counter\ngb_halt_cycles_total %llu\n",
+	  (unsigned long long) m->haltCycles);
+  fprintf(file, "# TYPE gb_bank_switches_total counter\ngb_bank_switches_total %llu\n",
+	  (unsigned long long) m->bankSwitches);
+
+  fprintf(file, "# TYPE gb_memory_reads_total counter\n");
+  for (i = 0; i < REGION_COUNT; i++) {
+    fprintf(file, "gb_memory_reads_total{region=\"%s\"} %llu\n", regionNames[i],
+	    (unsigned long long) m->reads[i]);
+  }
+  fprintf(file, "# TYPE gb_memory_writes_total counter\n");
+  for (i = 0; i < REGION_COUNT; i++) {
+    fprintf(file, "gb_memory_writes_total{region=\"%s\"} %llu\n", regionNames[i],
+	    (unsigned long long) m->writes[i]);
+  }
+  fprintf(file, "# TYPE gb_interrupts_total counter\n");
+  for (i = 0; i < 5; i++) {
+    fprintf(file, "gb_interrupts_total{interrupt=\"%s\"} %llu\n", interruptNames[i],
+	    (unsigned long long) m->interrupts[i]);
+  }
+  fprintf(file, "# TYPE gb_io_writes_total counter\n");
+  for (i = 0; i < 0x100; i++) {
+    if (m->ioWrites[i] != 0) {
+      fprintf(file, "gb_io_writes_total{address=\"0xFF%02X\"} %llu\n", i,
+	      (unsigned long long) m->ioWrites[i]);
+    }
+  }
+
+  if (fclose(file) != 0 || rename(temporary, path) != 0) {
+    printf("Error: could not write metrics to %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+void startMetricsExport(const char *path) {
+  metricsPath = path;
+  framesSinceExport = 0;
+}
+
+// Called once per frame; rewrites the metrics file every metricsInterval
+// frames.
+void exportMetrics() {
+  if (metricsPath == NULL || ++framesSinceExport < metricsInterval) {
+    return;
+  }
+  framesSinceExport = 0;
+  writeMetricsFile(metricsPath);
+}
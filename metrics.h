@@ -0,0 +1,44 @@
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_METRICS_THREADS 8
+#define METRICS_INTERVAL 60 // frames between metrics file exports
+
+typedef enum { REGION_ROM, REGION_VRAM, REGION_SRAM, REGION_WRAM, REGION_OAM,
+	       REGION_IO, REGION_HRAM, REGION_COUNT } memoryRegion;
+
+// Counters for one thread. Each thread only ever writes its own block, so
+// the hot path is plain increments; readers sum the blocks and may see a
+// count a few increments stale, never a torn one (aligned 64-bit loads).
+typedef struct {
+  uint64_t instructions;
+  uint64_t reads[REGION_COUNT];
+  uint64_t writes[REGION_COUNT];
+  uint64_t interrupts[5];    // by IF bit
+  uint64_t haltCycles;
+  uint64_t bankSwitches;
+  uint64_t ioWrites[0x100];  // writes to 0xFF00-0xFFFF by low byte
+} __attribute__((aligned(64))) metricsBlock;
+
+// What gets exported: the summed counters plus the machine's clocks.
+typedef struct {
+  uint64_t cycles;
+  uint64_t frames;
+  metricsBlock counters;
+} metricsSnapshot;
+
+extern __thread metricsBlock metrics;
+extern const uint8_t pageRegion[0x100];
+extern int metricsInterval;
+
+void registerMetrics(void);
+void unregisterMetrics(void);
+void collectMetrics(metricsSnapshot *);
+bool writeMetricsFile(const char *);
+void startMetricsExport(const char *);
+void exportMetrics(void);
+
+#endif
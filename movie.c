@@ -0,0 +1,186 @@
+#include "movie.h"
+#include "cartridge.h"
+
+FILE *movieFile = NULL;
+movieHeader header;
+movieKeyframe *keyframes = NULL;
+uint32_t keyframeCapacity = 0;
+uint32_t movieFrame;
+
+// scratch space for keyframes, too big for the stack
+machineState keyframeState;
+machineState currentState;
+
+void writeKeyframe() {
+  if (header.keyframeCount == keyframeCapacity) {
+    keyframeCapacity = keyframeCapacity ? keyframeCapacity * 2 : 64;
+    keyframes = realloc(keyframes, keyframeCapacity * sizeof(movieKeyframe));
+  }
+
+  movieKeyframe *keyframe = &keyframes[header.keyframeCount++];
+  keyframe->frame = movieFrame;
+  keyframe->reserved = 0;
+  keyframe->offset = ftell(movieFile);
+
+  saveState(&keyframeState);
+  fwrite(&keyframeState, sizeof(keyframeState), 1, movieFile);
+}
+
+// Start recording from the current machine state. Every keyframeInterval
+// frames a full save state is embedded so playback can seek.
+bool startRecording(const char *path, uint32_t keyframeInterval) {
+  movieFile = fopen(path, "wb");
+  if (movieFile == NULL) {
+    printf("Error: could not create movie %s\n", path);
+    return false;
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = MOVIE_MAGIC;
+  header.version = MOVIE_VERSION;
+  header.stateVersion = STATE_VERSION;
+  header.romChecksum = romChecksum();
+  header.keyframeInterval = keyframeInterval ? keyframeInterval : 1;
+  fwrite(&header, sizeof(header), 1, movieFile); // rewritten by stopRecording
+
+  movieFrame = 0;
+  return true;
+}
+
+// Emulate one frame with the given buttons held and append it to the movie.
+void recordMovieFrame(uint8_t buttons) {
+  if (movieFrame % header.keyframeInterval == 0) {
+    writeKeyframe();
+  }
+  fputc(buttons, movieFile);
+
+  setJoypad(buttons);
+  runFrame();
+  movieFrame++;
+}
+
+void stopRecording() {
+  if (movieFile == NULL) {
+    return;
+  }
+
+  header.frameCount = movieFrame;
+  header.indexOffset = ftell(movieFile);
+  fwrite(keyframes, sizeof(movieKeyframe), header.keyframeCount, movieFile);
+  fseek(movieFile, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, movieFile);
+
+  fclose(movieFile);
+  movieFile = NULL;
+  free(keyframes);
+  keyframes = NULL;
+  keyframeCapacity = 0;
+}
+
+bool startPlayback(const char *path) {
+  movieFile = fopen(path, "rb");
+  if (movieFile == NULL) {
+    printf("Error: could not open movie %s\n", path);
+    return false;
+  }
+
+  if (fread(&header, sizeof(header), 1, movieFile) != 1 ||
+      header.magic != MOVIE_MAGIC || header.version != MOVIE_VERSION) {
+    printf("Error: %s is not a movie file\n", path);
+    stopPlayback();
+    return false;
+  }
+  if (header.stateVersion != STATE_VERSION) {
+    printf("Error: movie %s was recorded with save state version %u, expected %u\n",
+	   path, header.stateVersion, STATE_VERSION);
+    stopPlayback();
+    return false;
+  }
+  if (header.romChecksum != romChecksum()) {
+    printf("Error: movie %s was recorded with a different ROM\n", path);
+    stopPlayback();
+    return false;
+  }
+
+  keyframes = malloc(header.keyframeCount * sizeof(movieKeyframe));
+  fseek(movieFile, header.indexOffset, SEEK_SET);
+  if (header.keyframeCount == 0 ||
+      fread(keyframes, sizeof(movieKeyframe), header.keyframeCount, movieFile) != header.keyframeCount) {
+    printf("Error: movie %s has a damaged keyframe index\n", path);
+    stopPlayback();
+    return false;
+  }
+
+  return seekMovie(0);
+}
+
+// Emulate the next frame of the movie. Returns false at the end.
+bool playMovieFrame() {
+  if (movieFrame >= header.frameCount) {
+    return false;
+  }
+
+  // Crossing into the next chunk: the embedded keyframe must match the
+  // state playback has reached, otherwise emulation is not deterministic.
+  if (movieFrame % header.keyframeInterval == 0 &&
+      (uint64_t) ftell(movieFile) == keyframes[movieFrame / header.keyframeInterval].offset) {
+    if (fread(&keyframeState, sizeof(keyframeState), 1, movieFile) != 1) {
+      return false;
+    }
+    saveState(&currentState);
+    if (memcmp(&keyframeState, &currentState, sizeof(currentState)) != 0) {
+      printf("Warning: movie desynced before frame %u\n", movieFrame);
+    }
+  }
+
+  int buttons = fgetc(movieFile);
+  if (buttons == EOF) {
+    return false;
+  }
+
+  setJoypad(buttons);
+  runFrame();
+  movieFrame++;
+  return true;
+}
+
+// Restore the nearest keyframe at or before frame and replay the rest.
+bool seekMovie(uint32_t frame) {
+  if (movieFile == NULL || frame > header.frameCount) {
+    return false;
+  }
+
+  uint32_t low = 0, high = header.keyframeCount - 1;
+  while (low < high) {
+    uint32_t middle = (low + high + 1) / 2;
+    if (keyframes[middle].frame <= frame) {
+      low = middle;
+    }
+    else {
+      high = middle - 1;
+    }
+  }
+
+  fseek(movieFile, keyframes[low].offset, SEEK_SET);
+  if (fread(&keyframeState, sizeof(keyframeState), 1, movieFile) != 1 ||
+      !loadState(&keyframeState)) {
+    return false;
+  }
+  movieFrame = keyframes[low].frame;
+
+  while (movieFrame < frame) {
+    if (!playMovieFrame()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void stopPlayback() {
+  if (movieFile != NULL) {
+    fclose(movieFile);
+    movieFile = NULL;
+  }
+  free(keyframes);
+  keyframes = NULL;
+}
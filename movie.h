@@ -0,0 +1,41 @@
+#ifndef MOVIE_H_INCLUDED
+#define MOVIE_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "savestate.h"
+
+#define MOVIE_MAGIC 0x564D4247 // "GBMV"
+#define MOVIE_VERSION 1
+
+// A movie file is the header, then one chunk per keyframe: the machine
+// state at the start of the chunk followed by one joypad byte per frame.
+// The keyframe index is appended at indexOffset when recording stops.
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t stateVersion;
+  uint32_t romChecksum;
+  uint32_t keyframeInterval;
+  uint32_t frameCount;
+  uint32_t keyframeCount;
+  uint32_t reserved;
+  uint64_t indexOffset;
+} movieHeader;
+
+typedef struct {
+  uint32_t frame;
+  uint32_t reserved;
+  uint64_t offset;
+} movieKeyframe;
+
+bool startRecording(const char *, uint32_t);
+void recordMovieFrame(uint8_t);
+void stopRecording(void);
+
+bool startPlayback(const char *);
+bool playMovieFrame(void);
+bool seekMovie(uint32_t);
+void stopPlayback(void);
+
+#endif
@@ -0,0 +1,276 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pipeline.h"
+#include "capture.h"
+#include "memory.h"
+#include "metrics.h"
+#include "ppu.h"
+#include "render.h"
+
+// Line composition on a second thread, a frame behind the emulation. At the
+// end of mode 3 the PPU only records the LCD registers and where the window
+// is; VRAM and OAM writes are journalled in order, each line remembering
+// how far into the journal it was drawn. The render thread keeps its own
+// copy of VRAM and OAM and replays the journal up to each line's mark
+// before composing it, so it sees exactly what renderLine would have.
+//
+// Work moves in jobs: the one being filled and the one being drawn. At the
+// end of a frame the emulator collects the drawn job, copies its lines into
+// the framebuffer and hands over the one it just filled, so the
+// framebuffer, capture and shared memory show each frame one frame late
+// but bit for bit as the synchronous renderer would have left them.
+
+// lines a job may collect outside runFrame before it is flushed
+#define PIPELINE_MAX_LINES (SCREEN_HEIGHT * 4)
+
+typedef struct {
+  uint8_t line;
+  uint8_t windowLine;
+  uint8_t registers[LCD_REGISTERS];
+  uint32_t journalMark; // journal entries applied before this line is drawn
+  uint8_t pixels[SCREEN_WIDTH];
+} lineRecord;
+
+typedef struct {
+  uint16_t address;
+  uint8_t value;
+} journalEntry;
+
+typedef struct {
+  lineRecord *lines;
+  uint32_t lineCount, lineSize;
+  journalEntry *journal;
+  uint32_t journalCount, journalSize;
+  bool frameEnd; // a whole frame, to be captured once it is published
+} renderJob;
+
+bool pipelineActive = false;
+pipelineStats pipeline;
+
+pthread_t renderThread;
+pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t jobReady = PTHREAD_COND_INITIALIZER;
+pthread_cond_t jobDone = PTHREAD_COND_INITIALIZER;
+bool jobPending, renderStopping;
+
+renderJob jobs[2];
+renderJob *fillJob, *drawJob;
+// the render thread's VRAM and OAM, indexed by address
+uint8_t renderMemory[MEMORY_SIZE];
+spriteTable workerSprites;
+
+uint64_t pipelineNanoseconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void applyJournal(const renderJob *job, uint32_t from, uint32_t to) {
+  uint32_t i;
+  for (i = from; i < to; i++) {
+    renderMemory[job->journal[i].address] = job->journal[i].value;
+    if (job->journal[i].address >= 0xFE00) {
+      workerSprites.dirty = true;
+    }
+  }
+}
+
+void drawJobLines(renderJob *job) {
+  lineSource source = { renderMemory + 0x8000, renderMemory + 0xFE00, &workerSprites, NULL, 0 };
+  uint32_t applied = 0;
+  uint32_t i;
+
+  for (i = 0; i < job->lineCount; i++) {
+    lineRecord *record = &job->lines[i];
+    applyJournal(job, applied, record->journalMark);
+    applied = record->journalMark;
+    source.registers = record->registers;
+    source.windowLine = record->windowLine;
+    composeLine(&source, record->line, record->pixels);
+  }
+  applyJournal(job, applied, job->journalCount);
+}
+
+void *renderMain(void *unused) {
+  (void) unused;
+  registerMetrics();
+  pthread_mutex_lock(&jobLock);
+  for (;;) {
+    while (!jobPending && !renderStopping) {
+      pthread_cond_wait(&jobReady, &jobLock);
+    }
+    if (!jobPending) {
+      break;
+    }
+    pthread_mutex_unlock(&jobLock);
+
+    drawJobLines(drawJob);
+
+    pthread_mutex_lock(&jobLock);
+    jobPending = false;
+    pthread_cond_signal(&jobDone);
+  }
+  pthread_mutex_unlock(&jobLock);
+  unregisterMetrics();
+  return NULL;
+}
+
+// Emulation thread side: wait for the job being drawn, if any, and copy its
+// lines into the framebuffer. Returns whether it finished a frame.
+bool collectJob() {
+  pthread_mutex_lock(&jobLock);
+  if (jobPending) {
+    uint64_t start = pipelineNanoseconds();
+    pipeline.waits++;
+    while (jobPending) {
+      pthread_cond_wait(&jobDone, &jobLock);
+    }
+    pipeline.waitNanoseconds += pipelineNanoseconds() - start;
+  }
+  pthread_mutex_unlock(&jobLock);
+
+  uint32_t i;
+  for (i = 0; i < drawJob->lineCount; i++) {
+    memcpy(framebuffer + drawJob->lines[i].line * SCREEN_WIDTH, drawJob->lines[i].pixels, SCREEN_WIDTH);
+  }
+  bool frameEnd = drawJob->frameEnd;
+  drawJob->lineCount = 0;
+  drawJob->journalCount = 0;
+  drawJob->frameEnd = false;
+  return frameEnd;
+}
+
+void submitJob(bool frameEnd) {
+  renderJob *job = fillJob;
+  fillJob = drawJob;
+  job->frameEnd = frameEnd;
+  pipeline.jobs++;
+  pipeline.lines += job->lineCount;
+  pipeline.journalled += job->journalCount;
+
+  pthread_mutex_lock(&jobLock);
+  drawJob = job;
+  jobPending = true;
+  pthread_cond_signal(&jobReady);
+  pthread_mutex_unlock(&jobLock);
+}
+
+bool startPipeline() {
+  if (pipelineActive) {
+    return true;
+  }
+  memset(jobs, 0, sizeof(jobs));
+  fillJob = &jobs[0];
+  drawJob = &jobs[1];
+  jobPending = false;
+  renderStopping = false;
+  memcpy(renderMemory + 0x8000, memory + 0x8000, 0x2000);
+  memcpy(renderMemory + 0xFE00, memory + 0xFE00, 0x100);
+  workerSprites.dirty = true;
+
+  if (pthread_create(&renderThread, NULL, renderMain, NULL) != 0) {
+    printf("Error: could not start render thread\n");
+    return false;
+  }
+  pipelineActive = true;
+  refreshPages();
+  return true;
+}
+
+// Draws what is left, including the frame still in flight, and goes back to
+// rendering on the emulation thread.
+void stopPipeline() {
+  if (!pipelineActive) {
+    return;
+  }
+  flushPipeline();
+
+  pthread_mutex_lock(&jobLock);
+  renderStopping = true;
+  pthread_cond_signal(&jobReady);
+  pthread_mutex_unlock(&jobLock);
+  pthread_join(renderThread, NULL);
+
+  pipelineActive = false;
+  refreshPages();
+  int i;
+  for (i = 0; i < 2; i++) {
+    free(jobs[i].lines);
+    free(jobs[i].journal);
+  }
+  memset(jobs, 0, sizeof(jobs));
+}
+
+// Called by the PPU in place of renderLine.
+void pipelineLine(uint8_t line) {
+  renderJob *job = fillJob;
+  if (job->lineCount == job->lineSize) {
+    job->lineSize = job->lineSize ? job->lineSize * 2 : SCREEN_HEIGHT;
+    job->lines = realloc(job->lines, job->lineSize * sizeof(lineRecord));
+  }
+  lineRecord *record = &job->lines[job->lineCount++];
+  record->line = line;
+  record->windowLine = ppu.windowLine;
+  memcpy(record->registers, memory + 0xFF40, LCD_REGISTERS);
+  record->journalMark = job->journalCount;
+
+  if (job->lineCount >= PIPELINE_MAX_LINES) { // not running whole frames
+    flushPipeline();
+  }
+}
+
+// A write to VRAM or OAM, after it has been made to memory.
+void pipelineWrite(uint16_t address, uint8_t value) {
+  renderJob *job = fillJob;
+  if (job->journalCount == job->journalSize) {
+    job->journalSize = job->journalSize ? job->journalSize * 2 : 0x1000;
+    job->journal = realloc(job->journal, job->journalSize * sizeof(journalEntry));
+  }
+  job->journal[job->journalCount].address = address;
+  job->journal[job->journalCount].value = value;
+  job->journalCount++;
+}
+
+// A block copy into VRAM or OAM, journalled from memory once it is done.
+void pipelineBlock(uint16_t address, uint16_t length) {
+  uint16_t i;
+  for (i = 0; i < length; i++) {
+    pipelineWrite(address + i, memory[address + i]);
+  }
+}
+
+// End of a frame: publish the frame before and start drawing this one.
+// Returns whether a whole frame was published.
+bool pipelineFrame() {
+  bool frameEnd = collectJob();
+  submitJob(true);
+  return frameEnd;
+}
+
+// Draw everything recorded so far and wait for it, leaving the framebuffer
+// as the synchronous renderer would have it.
+void flushPipeline() {
+  if (!pipelineActive) {
+    return;
+  }
+  if (collectJob()) {
+    captureFrame();
+  }
+  submitJob(false);
+  collectJob();
+}
+
+// Resynchronise the render thread's VRAM and OAM after memory was replaced
+// wholesale, e.g. by loading a state.
+void syncPipeline() {
+  if (!pipelineActive) {
+    return;
+  }
+  flushPipeline();
+  memcpy(renderMemory + 0x8000, memory + 0x8000, 0x2000);
+  memcpy(renderMemory + 0xFE00, memory + 0xFE00, 0x100);
+  workerSprites.dirty = true;
+}
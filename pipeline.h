@@ -0,0 +1,27 @@
+#ifndef PIPELINE_H_INCLUDED
+#define PIPELINE_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+  uint64_t jobs;             // jobs handed to the render thread
+  uint64_t lines;            // lines it composed
+  uint64_t journalled;       // VRAM/OAM writes replayed on its copy
+  uint64_t waits;            // times the emulator waited for it
+  uint64_t waitNanoseconds;
+} pipelineStats;
+
+extern bool pipelineActive;
+extern pipelineStats pipeline;
+
+bool startPipeline(void);
+void stopPipeline(void);
+void pipelineLine(uint8_t);
+void pipelineWrite(uint16_t, uint8_t);
+void pipelineBlock(uint16_t, uint16_t);
+bool pipelineFrame(void);
+void flushPipeline(void);
+void syncPipeline(void);
+
+#endif
@@ -0,0 +1,159 @@
+#include "ppu.h"
+#include "cgb.h"
+#include "cpu.h"
+#include "interrupts.h"
+#include "memory.h"
+#include "pipeline.h"
+#include "render.h"
+#include "scheduler.h"
+
+uint8_t framebufferImage[SCREEN_WIDTH * SCREEN_HEIGHT];
+uint8_t *framebuffer = framebufferImage;
+ppuState ppu;
+int frameSkip = 0;
+
+void startLine(uint8_t, uint64_t);
+
+// The mode/line state machine runs off EVENT_PPU whether or not anything is
+// drawn, so LY, STAT and the interrupts stay exact on skipped frames. Pixels
+// are only composed, a line at a time, on frames picked for rendering.
+
+void initializePPU() {
+  syncPipeline();
+  invalidateSprites();
+  memset(framebuffer, 0, SCREEN_WIDTH * SCREEN_HEIGHT);
+  memset(&ppu, 0, sizeof(ppu));
+  memory[0xFF41] = 0x80;
+  memory[0xFF44] = 0;
+  cancelEvent(EVENT_PPU);
+  if (memory[0xFF40] & 0x80) {
+    startLine(0, cycles);
+  }
+}
+
+// Point the PPU output at another buffer of SCREEN_WIDTH * SCREEN_HEIGHT bytes.
+void setFramebuffer(uint8_t *buffer) {
+  framebuffer = buffer;
+}
+
+// Render the next frame even if frameSkip would drop it.
+void renderNextFrame() {
+  ppu.renderRequested = true;
+}
+
+void updateStat() {
+  uint8_t stat = memory[0xFF41];
+  bool coincidence = ppu.line == memory[0xFF45];
+
+  stat = (stat & 0x78) | 0x80 | (coincidence ? 0x04 : 0) | ppu.mode;
+  memory[0xFF41] = stat;
+
+  bool line = ((stat & 0x40) && coincidence) ||
+    ((stat & 0x08) && ppu.mode == MODE_HBLANK) ||
+    ((stat & 0x10) && ppu.mode == MODE_VBLANK) ||
+    ((stat & 0x20) && ppu.mode == MODE_OAM);
+  if (line && !ppu.statLine) {
+    requestInterrupt(INT_STAT);
+  }
+  ppu.statLine = line;
+}
+
+void startFrame() {
+  ppu.windowLine = 0;
+  ppu.rendering = ppu.renderRequested || (frameSkip >= 0 && ppu.skipCounter == 0);
+  ppu.renderRequested = false;
+  if (frameSkip >= 0) {
+    ppu.skipCounter = ppu.skipCounter >= frameSkip ? 0 : ppu.skipCounter + 1;
+  }
+}
+
+void startLine(uint8_t line, uint64_t start) {
+  ppu.line = line;
+  memory[0xFF44] = line;
+  if (line == 0) {
+    startFrame();
+  }
+
+  if (line < SCREEN_HEIGHT) {
+    ppu.mode = MODE_OAM;
+    scheduleEvent(EVENT_PPU, start + OAM_CYCLES);
+  }
+  else {
+    if (line == SCREEN_HEIGHT) {
+      ppu.mode = MODE_VBLANK;
+      ppu.frames++;
+      if (ppu.rendering) {
+	ppu.renderedFrames++;
+      }
+      requestInterrupt(INT_VBLANK);
+    }
+    scheduleEvent(EVENT_PPU, start + CYCLES_PER_LINE);
+  }
+  updateStat();
+}
+
+// End of the current mode; due is when it was scheduled, so late handling
+// (e.g. after a long instruction) does not drift the timing.
+void ppuEvent(uint64_t due) {
+  switch (ppu.mode) {
+  case MODE_OAM:
+    ppu.mode = MODE_TRANSFER;
+    scheduleEvent(EVENT_PPU, due + TRANSFER_CYCLES);
+    updateStat();
+    break;
+  case MODE_TRANSFER:
+    if (ppu.rendering && pipelineActive) {
+      pipelineLine(ppu.line);
+      if (windowOnLine(memory + 0xFF40, ppu.line)) {
+	ppu.windowLine++;
+      }
+    }
+    else if (ppu.rendering) {
+      renderLine(ppu.line);
+    }
+    ppu.mode = MODE_HBLANK;
+    scheduleEvent(EVENT_PPU, due + CYCLES_PER_LINE - OAM_CYCLES - TRANSFER_CYCLES);
+    updateStat();
+    if (cgb.hdmaActive) {
+      hdmaBlock();
+    }
+    break;
+  case MODE_HBLANK:
+    startLine(ppu.line + 1, due);
+    break;
+  case MODE_VBLANK:
+    startLine(ppu.line == LINES_PER_FRAME - 1 ? 0 : ppu.line + 1, due);
+    break;
+  }
+}
+
+void writePPU(uint16_t address, uint8_t value) {
+  switch (address) {
+  case 0xFF40: // LCDC
+    if ((value & 0x80) && !(memory[0xFF40] & 0x80)) {
+      memory[0xFF40] = value;
+      startLine(0, cycles);
+      return;
+    }
+    if (!(value & 0x80) && (memory[0xFF40] & 0x80)) {
+      cancelEvent(EVENT_PPU);
+      ppu.line = 0;
+      ppu.mode = MODE_HBLANK;
+      memory[0xFF44] = 0;
+      memory[0xFF41] &= 0xF8;
+    }
+    memory[0xFF40] = value;
+    break;
+  case 0xFF41: // STAT, only the interrupt enables are writable
+    memory[0xFF41] = (memory[0xFF41] & 0x07) | (value & 0x78);
+    break;
+  case 0xFF44: // LY is read-only
+    return;
+  case 0xFF45: // LYC
+    memory[0xFF45] = value;
+    break;
+  }
+  if (memory[0xFF40] & 0x80) {
+    updateStat();
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef PPU_H_INCLUDED
+#define PPU_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SCREEN_WIDTH 160
+#define SCREEN_HEIGHT 144
+
+#define LINES_PER_FRAME 154
+#define CYCLES_PER_LINE 456
+#define OAM_CYCLES 80
+#define TRANSFER_CYCLES 172
+
+// STAT mode bits
+#define MODE_HBLANK 0
+#define MODE_VBLANK 1
+#define MODE_OAM 2
+#define MODE_TRANSFER 3
+
+// frameSkip value that only renders frames asked for with renderNextFrame
+#define FRAME_SKIP_ALL -1
+
+// Timing state. LY and STAT themselves live in memory[0xFF44]/[0xFF41].
+typedef struct {
+  uint8_t mode;
+  uint8_t line;
+  uint8_t windowLine;
+  bool statLine;        // STAT interrupt line, the interrupt fires on its rising edge
+  bool rendering;       // composing pixels for the current frame
+  bool renderRequested;
+  int32_t skipCounter;
+  uint64_t frames;      // frames completed, counted at the start of VBlank
+  uint64_t renderedFrames;
+} ppuState;
+
+// one byte per pixel, shade 0-3, row-major
+extern uint8_t *framebuffer;
+extern ppuState ppu;
+// frames skipped between rendered ones, or FRAME_SKIP_ALL
+extern int frameSkip;
+
+void initializePPU(void);
+void setFramebuffer(uint8_t *);
+void renderNextFrame(void);
+void writePPU(uint16_t, uint8_t);
+void ppuEvent(uint64_t);
+
+#endif
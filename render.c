@@ -0,0 +1,166 @@
+#include "render.h"
+#include "memory.h"
+#include "ppu.h"
+
+// Pixel composition for one scanline from VRAM, OAM and the LCD registers.
+// Knows nothing about timing; the PPU calls it at the end of mode 3 on
+// frames that are being rendered, either on the live memory image or, with
+// the render pipeline, on the worker's copy of how it looked then.
+//
+// Which sprites fall on which line only changes with OAM or the sprite
+// height, so rather than scanning all 40 entries on every line, the lists
+// for the whole screen are built in one pass the first time a line is drawn
+// after a change, normally once after the OAM DMA in VBlank.
+
+// for the live memory image; OAM writes, DMA and remaps mark it dirty
+spriteTable liveSprites = { .dirty = true };
+
+void invalidateSprites() {
+  liveSprites.dirty = true;
+}
+
+// colour number 0-3 of pixel x (0 = leftmost) in a tile row
+uint8_t tilePixel(const uint8_t *row, int x) {
+  int bit = 7 - x;
+  return ((row[0] >> bit) & 1) | (((row[1] >> bit) & 1) << 1);
+}
+
+// address of a background/window tile's data, honouring LCDC bit 4
+const uint8_t *tileData(const lineSource *source, uint8_t lcdc, uint8_t tile) {
+  if (lcdc & 0x10) {
+    return source->vram + tile * 16;
+  }
+  return source->vram + 0x1000 + (int8_t) tile * 16;
+}
+
+// Whether the window shows on this line, which is also when its own line
+// counter moves on.
+bool windowOnLine(const uint8_t *registers, uint8_t line) {
+  uint8_t lcdc = registers[LCD_LCDC];
+  return (lcdc & 0x01) && (lcdc & 0x20) && line >= registers[LCD_WY] &&
+    registers[LCD_WX] - 7 < SCREEN_WIDTH;
+}
+
+void renderBackground(const lineSource *source, uint8_t line, uint8_t lcdc, uint8_t *colours) {
+  uint8_t scrollY = source->registers[LCD_SCY];
+  uint8_t scrollX = source->registers[LCD_SCX];
+  int windowX = source->registers[LCD_WX] - 7;
+  const uint8_t *map = source->vram + (lcdc & 0x08 ? 0x1C00 : 0x1800);
+  uint8_t y = line + scrollY;
+  int x;
+
+  if (!(lcdc & 0x01)) { // background and window off
+    memset(colours, 0, SCREEN_WIDTH);
+    return;
+  }
+
+  for (x = 0; x < SCREEN_WIDTH; x++) {
+    uint8_t column = x + scrollX;
+    const uint8_t *row = tileData(source, lcdc, map[(y / 8) * 32 + column / 8]) + (y % 8) * 2;
+    colours[x] = tilePixel(row, column % 8);
+  }
+
+  if (windowOnLine(source->registers, line)) {
+    const uint8_t *windowMap = source->vram + (lcdc & 0x40 ? 0x1C00 : 0x1800);
+    uint8_t wy = source->windowLine;
+    for (x = windowX < 0 ? 0 : windowX; x < SCREEN_WIDTH; x++) {
+      uint8_t column = x - windowX;
+      const uint8_t *row = tileData(source, lcdc, windowMap[(wy / 8) * 32 + column / 8]) + (wy % 8) * 2;
+      colours[x] = tilePixel(row, column % 8);
+    }
+  }
+}
+
+void buildSpriteTable(spriteTable *table, const uint8_t *oam, uint8_t height) {
+  int i, j, line;
+
+  // the first ten sprites in OAM order that cover each line
+  memset(table->count, 0, sizeof(table->count));
+  for (i = 0; i < 40; i++) {
+    int top = oam[i * 4] - 16;
+    for (line = top < 0 ? 0 : top; line < top + height && line < SCREEN_HEIGHT; line++) {
+      if (table->count[line] < MAX_LINE_SPRITES) {
+	table->sprites[line][table->count[line]++] = i;
+      }
+    }
+  }
+
+  // draw from lowest to highest priority: smaller X wins, then OAM order
+  for (line = 0; line < SCREEN_HEIGHT; line++) {
+    uint8_t *selected = table->sprites[line];
+    for (i = 0; i < table->count[line]; i++) {
+      for (j = i + 1; j < table->count[line]; j++) {
+	if (oam[selected[j] * 4 + 1] > oam[selected[i] * 4 + 1] ||
+	    (oam[selected[j] * 4 + 1] == oam[selected[i] * 4 + 1] && selected[j] > selected[i])) {
+	  uint8_t swap = selected[i];
+	  selected[i] = selected[j];
+	  selected[j] = swap;
+	}
+      }
+    }
+  }
+  table->height = height;
+  table->dirty = false;
+}
+
+void renderSprites(const lineSource *source, uint8_t line, uint8_t lcdc,
+		   const uint8_t *colours, uint8_t *pixels) {
+  int height = lcdc & 0x04 ? 16 : 8;
+  const uint8_t *oam = source->oam;
+  spriteTable *table = source->sprites;
+  int i, x;
+
+  if (table->dirty || table->height != height) {
+    buildSpriteTable(table, oam, height);
+  }
+
+  for (i = 0; i < table->count[line]; i++) {
+    const uint8_t *sprite = oam + table->sprites[line][i] * 4;
+    int left = sprite[1] - 8;
+    uint8_t tile = height == 16 ? sprite[2] & 0xFE : sprite[2];
+    uint8_t attributes = sprite[3];
+    uint8_t palette = source->registers[attributes & 0x10 ? LCD_OBP1 : LCD_OBP0];
+    int row = line - (sprite[0] - 16);
+    if (attributes & 0x40) { // Y flip
+      row = height - 1 - row;
+    }
+    const uint8_t *data = source->vram + tile * 16 + row * 2;
+
+    for (x = 0; x < 8; x++) {
+      int screenX = left + x;
+      if (screenX < 0 || screenX >= SCREEN_WIDTH) {
+	continue;
+      }
+      uint8_t colour = tilePixel(data, attributes & 0x20 ? 7 - x : x);
+      if (colour == 0 || ((attributes & 0x80) && colours[screenX] != 0)) {
+	continue;
+      }
+      pixels[screenX] = (palette >> (colour * 2)) & 3;
+    }
+  }
+}
+
+void composeLine(const lineSource *source, uint8_t line, uint8_t *pixels) {
+  uint8_t lcdc = source->registers[LCD_LCDC];
+  uint8_t palette = source->registers[LCD_BGP];
+  uint8_t colours[SCREEN_WIDTH];
+  int x;
+
+  renderBackground(source, line, lcdc, colours);
+  for (x = 0; x < SCREEN_WIDTH; x++) {
+    pixels[x] = (palette >> (colours[x] * 2)) & 3;
+  }
+  if (lcdc & 0x02) {
+    renderSprites(source, line, lcdc, colours, pixels);
+  }
+}
+
+// Draw a line of the framebuffer from the live memory image.
+void renderLine(uint8_t line) {
+  lineSource source = { memory + 0x8000, memory + 0xFE00, &liveSprites, memory + 0xFF40, ppu.windowLine };
+
+  composeLine(&source, line, framebuffer + line * SCREEN_WIDTH);
+  if (windowOnLine(source.registers, line)) {
+    ppu.windowLine++;
+  }
+}
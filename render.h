@@ -0,0 +1,45 @@
+#ifndef RENDER_H_INCLUDED
+#define RENDER_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ppu.h"
+
+#define MAX_LINE_SPRITES 10
+
+// LCD registers by offset from 0xFF40
+#define LCD_LCDC 0x0
+#define LCD_SCY 0x2
+#define LCD_SCX 0x3
+#define LCD_BGP 0x7
+#define LCD_OBP0 0x8
+#define LCD_OBP1 0x9
+#define LCD_WY 0xA
+#define LCD_WX 0xB
+#define LCD_REGISTERS 12
+
+// The sprites on each line, at most MAX_LINE_SPRITES, as OAM indices in
+// drawing order. Rebuilt from OAM when dirty or the sprite height changed.
+typedef struct {
+  bool dirty;
+  uint8_t height;
+  uint8_t count[SCREEN_HEIGHT];
+  uint8_t sprites[SCREEN_HEIGHT][MAX_LINE_SPRITES];
+} spriteTable;
+
+// What a line is drawn from: VRAM from 0x8000, OAM and its sprite table,
+// the LCD registers 0xFF40-0xFF4B and where the window has got to.
+typedef struct {
+  const uint8_t *vram;
+  const uint8_t *oam;
+  spriteTable *sprites;
+  const uint8_t *registers;
+  uint8_t windowLine;
+} lineSource;
+
+void invalidateSprites(void);
+bool windowOnLine(const uint8_t *, uint8_t);
+void composeLine(const lineSource *, uint8_t, uint8_t *);
+void renderLine(uint8_t);
+
+#endif
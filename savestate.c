@@ -0,0 +1,67 @@
+#include "savestate.h"
+#include "cheats.h"
+#include "dma.h"
+#include "pipeline.h"
+#include "statehash.h"
+
+void saveState(machineState *state) {
+  memset(state, 0, sizeof(*state)); // padding too, so states can be memcmp'd
+  state->version = STATE_VERSION;
+  saveCPUState(&state->cpu);
+  state->cycles = cycles;
+  state->frameCount = frameCount;
+  state->joypadSelect = joypadSelect;
+  state->joypadButtons = joypadButtons;
+  state->eiDelay = eiDelay;
+  state->dmaActive = dmaActive;
+  state->timer = timer;
+  state->ppu = ppu;
+  state->cgbMode = cgbMode;
+  state->cgb = cgb;
+  state->mbc = mbc;
+  memcpy(state->eventCycle, eventCycle, sizeof(eventCycle));
+  memcpy(state->memory, memory, sizeof(state->memory));
+  state->sramSize = sramSize;
+  if (sram != NULL) {
+    memcpy(state->sram, sram, sramSize);
+  }
+}
+
+bool loadState(const machineState *state) {
+  if (state->version != STATE_VERSION) {
+    printf("Error: save state version %u, expected %u\n", state->version, STATE_VERSION);
+    return false;
+  }
+  if (state->sramSize != sramSize) {
+    printf("Error: save state has %u bytes of cartridge RAM, cartridge has %zu\n", state->sramSize, sramSize);
+    return false;
+  }
+  loadCPUState(&state->cpu);
+  cycles = state->cycles;
+  frameCount = state->frameCount;
+  memcpy(memory, state->memory, sizeof(state->memory));
+  // With --sav the RAM is the save file's mapping, so this rolls the file
+  // back too, as loading the state on hardware would.
+  if (sram != NULL) {
+    memcpy(sram, state->sram, sramSize);
+  }
+  joypadSelect = state->joypadSelect;
+  joypadButtons = state->joypadButtons;
+  eiDelay = state->eiDelay;
+  dmaActive = state->dmaActive;
+  timer = state->timer;
+  ppu = state->ppu;
+  cgbMode = state->cgbMode;
+  cgb = state->cgb;
+  mbc = state->mbc;
+  cycleShift = cgb.doubleSpeed;
+  memcpy(eventCycle, state->eventCycle, sizeof(eventCycle));
+  updateNextEvent();
+  updateInterrupts();
+  if (hasher != NULL) { // every page may have changed under the same pageBase
+    initializeStateHasher(hasher);
+  }
+  mapMemoryImage();
+  syncPipeline();
+  return true;
+}
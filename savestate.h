@@ -0,0 +1,41 @@
+#ifndef SAVESTATE_H_INCLUDED
+#define SAVESTATE_H_INCLUDED
+
+#include <stdint.h>
+#include "cartridge.h"
+#include "cgb.h"
+#include "cpu.h"
+#include "joypad.h"
+#include "memory.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "timer.h"
+
+// bump whenever machineState changes layout
+#define STATE_VERSION 8
+
+// Everything needed to resume emulation exactly where it was captured.
+typedef struct {
+  uint32_t version;
+  cpuState cpu;
+  uint64_t cycles;
+  uint64_t frameCount;
+  uint8_t joypadSelect;
+  uint8_t joypadButtons;
+  uint8_t eiDelay;
+  bool dmaActive;
+  timerState timer;
+  ppuState ppu;
+  bool cgbMode;
+  cgbState cgb;
+  mbcState mbc;
+  uint64_t eventCycle[EVENT_COUNT];
+  uint8_t memory[MEMORY_SIZE];
+  uint32_t sramSize;
+  uint8_t sram[SRAM_MAX_SIZE];
+} machineState;
+
+void saveState(machineState *);
+bool loadState(const machineState *);
+
+#endif
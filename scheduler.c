@@ -0,0 +1,61 @@
+#include "scheduler.h"
+#include "cpu.h"
+#include "dma.h"
+#include "ppu.h"
+#include "timer.h"
+
+uint64_t eventCycle[EVENT_COUNT];
+uint64_t nextEventCycle;
+
+void initializeScheduler() {
+  int event;
+  for (event = 0; event < EVENT_COUNT; event++) {
+    eventCycle[event] = NO_EVENT;
+  }
+  nextEventCycle = NO_EVENT;
+}
+
+void updateNextEvent() {
+  int event;
+  nextEventCycle = NO_EVENT;
+  for (event = 0; event < EVENT_COUNT; event++) {
+    if (eventCycle[event] < nextEventCycle) {
+      nextEventCycle = eventCycle[event];
+    }
+  }
+}
+
+void scheduleEvent(eventType event, uint64_t cycle) {
+  eventCycle[event] = cycle;
+  updateNextEvent();
+}
+
+void cancelEvent(eventType event) {
+  eventCycle[event] = NO_EVENT;
+  updateNextEvent();
+}
+
+// Fire every event that is due. Handlers may schedule themselves again.
+void runEvents() {
+  int event;
+  for (event = 0; event < EVENT_COUNT; event++) {
+    uint64_t due = eventCycle[event];
+    if (due > cycles) {
+      continue;
+    }
+    eventCycle[event] = NO_EVENT;
+
+    switch (event) {
+    case EVENT_TIMER:
+      timerOverflow(due);
+      break;
+    case EVENT_DMA:
+      finishDMA();
+      break;
+    case EVENT_PPU:
+      ppuEvent(due);
+      break;
+    }
+  }
+  updateNextEvent();
+}
@@ -0,0 +1,21 @@
+#ifndef SCHEDULER_H_INCLUDED
+#define SCHEDULER_H_INCLUDED
+
+#include <stdint.h>
+
+typedef enum { EVENT_TIMER, EVENT_DMA, EVENT_PPU, EVENT_COUNT } eventType;
+
+#define NO_EVENT UINT64_MAX
+
+// cycle at which each event fires, NO_EVENT when it is not scheduled
+extern uint64_t eventCycle[EVENT_COUNT];
+// earliest entry of eventCycle, the only thing the CPU loop looks at
+extern uint64_t nextEventCycle;
+
+void initializeScheduler(void);
+void scheduleEvent(eventType, uint64_t);
+void cancelEvent(eventType);
+void updateNextEvent(void);
+void runEvents(void);
+
+#endif
@@ -0,0 +1,109 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "shm.h"
+#include "memory.h"
+#include "ppu.h"
+
+#define SHM_MEMORY_OFFSET 64
+#define SHM_MEMORY_SIZE MEMORY_SIZE
+#define SHM_FRAMEBUFFER_OFFSET (SHM_MEMORY_OFFSET + SHM_MEMORY_SIZE)
+#define SHM_SNAPSHOT_OFFSET ((SHM_FRAMEBUFFER_OFFSET + SCREEN_WIDTH * SCREEN_HEIGHT + 63) & ~63)
+#define SHM_SNAPSHOT_SIZE ((sizeof(shmSnapshot) + 63) & ~63)
+#define SHM_SIZE (SHM_SNAPSHOT_OFFSET + 2 * SHM_SNAPSHOT_SIZE)
+
+_Static_assert(SHM_FRAMEBUFFER_SIZE == SCREEN_WIDTH * SCREEN_HEIGHT, "snapshot framebuffer size");
+
+shmHeader *sharedHeader = NULL;
+char sharedName[256];
+uint8_t *privateMemory;
+uint8_t *privateFramebuffer;
+
+// Move the memory image and framebuffer into a named POSIX shared memory
+// segment. Emulation carries on from the same state.
+bool openSharedMemory(const char *name) {
+  int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+  if (fd < 0) {
+    printf("Error: could not open shared memory %s\n", name);
+    return false;
+  }
+  if (ftruncate(fd, SHM_SIZE) != 0) {
+    printf("Error: could not size shared memory %s\n", name);
+    close(fd);
+    return false;
+  }
+  uint8_t *segment = mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED) {
+    printf("Error: could not map shared memory %s\n", name);
+    return false;
+  }
+
+  sharedHeader = (shmHeader *) segment;
+  sharedHeader->version = SHM_VERSION;
+  sharedHeader->published = 0;
+  sharedHeader->frame = 0;
+  sharedHeader->memoryOffset = SHM_MEMORY_OFFSET;
+  sharedHeader->memorySize = SHM_MEMORY_SIZE;
+  sharedHeader->framebufferOffset = SHM_FRAMEBUFFER_OFFSET;
+  sharedHeader->framebufferWidth = SCREEN_WIDTH;
+  sharedHeader->framebufferHeight = SCREEN_HEIGHT;
+  sharedHeader->snapshotOffset = SHM_SNAPSHOT_OFFSET;
+  sharedHeader->snapshotSize = SHM_SNAPSHOT_SIZE;
+  memset(segment + SHM_SNAPSHOT_OFFSET, 0, 2 * SHM_SNAPSHOT_SIZE);
+
+  privateMemory = getMemoryImage();
+  privateFramebuffer = framebuffer;
+  memcpy(segment + SHM_MEMORY_OFFSET, privateMemory, MEMORY_SIZE);
+  memcpy(segment + SHM_FRAMEBUFFER_OFFSET, privateFramebuffer, SCREEN_WIDTH * SCREEN_HEIGHT);
+  setMemoryImage(segment + SHM_MEMORY_OFFSET);
+  setFramebuffer(segment + SHM_FRAMEBUFFER_OFFSET);
+
+  // readers check the magic, so it goes in last
+  __atomic_store_n(&sharedHeader->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+  strncpy(sharedName, name, sizeof(sharedName) - 1);
+  return true;
+}
+
+void closeSharedMemory() {
+  if (sharedHeader == NULL) {
+    return;
+  }
+
+  uint8_t *segment = (uint8_t *) sharedHeader;
+  memcpy(privateMemory, segment + SHM_MEMORY_OFFSET, MEMORY_SIZE);
+  memcpy(privateFramebuffer, segment + SHM_FRAMEBUFFER_OFFSET, SCREEN_WIDTH * SCREEN_HEIGHT);
+  setMemoryImage(privateMemory);
+  setFramebuffer(privateFramebuffer);
+
+  munmap(segment, SHM_SIZE);
+  shm_unlink(sharedName);
+  sharedHeader = NULL;
+}
+
+// Copy this frame into the snapshot readers are not using and publish it.
+void endSharedFrame() {
+  if (sharedHeader == NULL) {
+    return;
+  }
+  uint32_t next = sharedHeader->published ^ 1;
+  shmSnapshot *snapshot = (shmSnapshot *) ((uint8_t *) sharedHeader + SHM_SNAPSHOT_OFFSET + next * SHM_SNAPSHOT_SIZE);
+  int page;
+
+  __atomic_store_n(&snapshot->sequence, snapshot->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  snapshot->frame = ++sharedHeader->frame;
+  for (page = 0; page < SHM_WRAM_SIZE >> 8; page++) {
+    memcpy(snapshot->wram + (page << 8), pageBase[0xC0 + page], 0x100);
+  }
+  memcpy(snapshot->hram, memory + 0xFF80, SHM_HRAM_SIZE);
+  memcpy(snapshot->framebuffer, framebuffer, SHM_FRAMEBUFFER_SIZE);
+  collectMetrics(&snapshot->metrics);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&snapshot->sequence, snapshot->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&sharedHeader->published, next, __ATOMIC_RELEASE);
+}
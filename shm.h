@@ -0,0 +1,65 @@
+#ifndef SHM_H_INCLUDED
+#define SHM_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "metrics.h"
+
+#define SHM_MAGIC 0x4D534247 // "GBSM"
+#define SHM_VERSION 3
+
+#define SHM_WRAM_SIZE 0x2000
+#define SHM_HRAM_SIZE 0x80
+#define SHM_FRAMEBUFFER_SIZE (160 * 144)
+
+// What the emulator publishes at the end of every frame: WRAM 0xC000-0xDFFF
+// (the banks mapped at the time on CGB), HRAM 0xFF80-0xFFFF with IE last, the
+// framebuffer and the counters, all from the same instant.
+typedef struct {
+  uint32_t sequence;
+  uint32_t reserved;
+  uint64_t frame;
+  uint8_t wram[SHM_WRAM_SIZE];
+  uint8_t hram[SHM_HRAM_SIZE];
+  uint8_t framebuffer[SHM_FRAMEBUFFER_SIZE];
+  metricsSnapshot metrics;
+} shmSnapshot;
+
+// Layout of the shared segment. The memory image and framebuffer at
+// memoryOffset and framebufferOffset are the emulator's own and change under
+// a reader at any time; they suit a live view that can tolerate tearing.
+//
+// Consistent reads go through the two shmSnapshots at snapshotOffset.
+// endSharedFrame() fills the one not named by published and then flips
+// published to it, so the latest complete frame stays readable while the
+// next is being emulated. Each snapshot's sequence is a seqlock around that
+// copy only: odd while it is being written. A reader takes
+// beginSharedRead(), reads from the snapshot it returns, and keeps the
+// result only if retrySharedRead() returns false, which needs the emulator
+// to finish two frames during the read.
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t published;
+  uint32_t reserved;
+  uint64_t frame;
+  uint32_t memoryOffset;
+  uint32_t memorySize;
+  uint32_t framebufferOffset;
+  uint16_t framebufferWidth;
+  uint16_t framebufferHeight;
+  uint32_t snapshotOffset;
+  uint32_t snapshotSize;
+} shmHeader;
+
+// emulator side
+bool openSharedMemory(const char *);
+void closeSharedMemory(void);
+void endSharedFrame(void);
+
+// reader side
+shmHeader *mapSharedMemory(const char *);
+const shmSnapshot *beginSharedRead(const shmHeader *, uint32_t *);
+bool retrySharedRead(const shmSnapshot *, uint32_t);
+
+#endif
@@ -0,0 +1,59 @@
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "shm.h"
+
+// Reader side of the shared segment. Kept apart from shm.c so analysis
+// tools can link it without the rest of the emulator.
+
+// Map an exported segment read-only. Returns NULL if it does not exist or
+// was written by an incompatible version.
+shmHeader *mapSharedMemory(const char *name) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(shmHeader)) {
+    close(fd);
+    return NULL;
+  }
+  shmHeader *header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (header == MAP_FAILED) {
+    return NULL;
+  }
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+      header->version != SHM_VERSION) {
+    munmap(header, st.st_size);
+    return NULL;
+  }
+  return header;
+}
+
+// Return the latest published snapshot and, through sequence, the number to
+// hand to retrySharedRead. The snapshot is only being written if the
+// emulator has lapped the reader, so the wait is short, but it gives up the
+// CPU rather than spin against an unthrottled emulator on the same core.
+const shmSnapshot *beginSharedRead(const shmHeader *header, uint32_t *sequence) {
+  const shmSnapshot *snapshot;
+  for (;;) {
+    uint32_t published = __atomic_load_n(&header->published, __ATOMIC_ACQUIRE);
+    snapshot = (const shmSnapshot *) ((const uint8_t *) header + header->snapshotOffset +
+				      published * header->snapshotSize);
+    *sequence = __atomic_load_n(&snapshot->sequence, __ATOMIC_ACQUIRE);
+    if (!(*sequence & 1)) {
+      return snapshot;
+    }
+    sched_yield();
+  }
+}
+
+// True if the emulator started overwriting the snapshot while the reader
+// was looking, in which case whatever was read must be thrown away.
+bool retrySharedRead(const shmSnapshot *snapshot, uint32_t sequence) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&snapshot->sequence, __ATOMIC_RELAXED) != sequence;
+}
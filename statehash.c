@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include "statehash.h"
+#include "cartridge.h"
+#include "cgb.h"
+#include "cpu.h"
+#include "dma.h"
+#include "interrupts.h"
+#include "joypad.h"
+#include "memory.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "timer.h"
+
+// A hash of the machine that costs the pages dirtied since the last one,
+// not the address space. Like watchpoints, it clears the fast writePage
+// entry of every clean page, so the first write to a page goes through
+// writeSlow and marks it; the entry comes back and later writes to that
+// page run at full speed until the next hash re-arms it. Pages that are
+// written around the page tables (OAM, I/O and HRAM, HDMA into VRAM,
+// freezes, the boot ROM unmapping) are marked where that happens or always
+// rehashed, and refreshPages marks a page whose pageBase moved, e.g. on a
+// bank switch. Echo RAM is not hashed; its writes mark the pages it mirrors.
+//
+// The pages feed a two-level Merkle tree, so a hash costs the dirty pages
+// and their groups rather than the whole address space, and the root
+// serves as a state fingerprint. Equal states always hash equal; unequal
+// ones may collide, which the state set settles with an exact compare.
+//
+// One hasher follows one machine; with several instances, each needs its
+// own, switched with useStateHasher alongside the instance.
+
+stateHasher *hasher = NULL;
+
+void initializeStateHasher(stateHasher *state) {
+  memset(state, 0, sizeof(*state));
+  memset(state->dirty, true, sizeof(state->dirty));
+}
+
+// Start tracking writes for this hasher, or stop with NULL. The CGB banks
+// switched in from cgb are shared by every instance and copied by
+// enterInstance behind the page tables, so pages mapping them are rehashed.
+void useStateHasher(stateHasher *state) {
+  int page;
+
+  hasher = state;
+  if (hasher != NULL && cgbMode) {
+    for (page = 0; page < 0x100; page++) {
+      if (pageBase[page] >= (const uint8_t *) &cgb && pageBase[page] < (const uint8_t *) (&cgb + 1)) {
+	hasher->dirty[page] = true;
+      }
+    }
+  }
+  refreshPages();
+}
+
+// Carry a hasher over to a copy of the memory it followed, e.g. a cloned
+// instance's arena, so only what differs afterwards is rehashed.
+void rebaseStateHasher(stateHasher *state, const uint8_t *from, const uint8_t *to, size_t size) {
+  int page;
+  for (page = 0; page < 0x100; page++) {
+    if (state->base[page] >= from && state->base[page] < from + size) {
+      state->base[page] = to + (state->base[page] - from);
+    }
+  }
+}
+
+void markPageDirty(uint8_t page) {
+  if (page >= 0xE0 && page < 0xFE) { // echo RAM, hashed as 0xC000-0xDDFF
+    page -= 0x20;
+  }
+  if (hasher != NULL && !hasher->dirty[page]) {
+    hasher->dirty[page] = true;
+    refreshPages();
+  }
+}
+
+uint64_t mix(uint64_t hash, uint64_t value) {
+  hash = (hash ^ value) * 0x9E3779B97F4A7C15ULL;
+  return hash ^ (hash >> 29);
+}
+
+uint64_t hashPage(const uint8_t *page) {
+  uint64_t hash = 0;
+  uint64_t word;
+  int i;
+  for (i = 0; i < 0x100; i += 8) {
+    memcpy(&word, page + i, 8);
+    hash = mix(hash, word);
+  }
+  return hash;
+}
+
+// Everything outside memory that decides what the machine does next.
+uint64_t hashMachine() {
+  cpuState cpu;
+  uint64_t hash = 0;
+  uint64_t word;
+  int i;
+
+  saveCPUState(&cpu);
+  memcpy(&word, cpu.registers, 8);
+  hash = mix(hash, word);
+  hash = mix(hash, cpu.pc | (uint64_t) cpu.sp << 16 | (uint64_t) cpu.prefixCB << 32 |
+	     (uint64_t) cpu.interruptsEnabled << 40 | (uint64_t) eiDelay << 48);
+  hash = mix(hash, cycles);
+  hash = mix(hash, frameCount);
+  hash = mix(hash, joypadSelect | joypadButtons << 8 | dmaActive << 16 | (uint64_t) timer.timaValue << 24 |
+	     (uint64_t) ppu.mode << 32 | (uint64_t) ppu.line << 40 | (uint64_t) ppu.windowLine << 48 |
+	     (uint64_t) ppu.statLine << 56);
+  hash = mix(hash, timer.divBase);
+  hash = mix(hash, timer.timaBase);
+  hash = mix(hash, mbc.romBank | mbc.ramBank << 16 | mbc.bankHigh << 24 | (uint64_t) mbc.mode << 32 |
+	     (uint64_t) mbc.ramEnabled << 40);
+  hash = mix(hash, cgb.vramBank | cgb.wramBank << 8 | cgb.doubleSpeed << 16 | cgb.hdmaActive << 17 |
+	     (uint64_t) cgb.hdmaSource << 24 | (uint64_t) cgb.hdmaDest << 40 | (uint64_t) cgb.hdmaBlocks << 56);
+  for (i = 0; i < EVENT_COUNT; i++) {
+    hash = mix(hash, eventCycle[i]);
+  }
+  return hash;
+}
+
+// The root over the address space as mapped now and hashMachine. Rehashes
+// the dirty pages, the groups they are in and the root; the I/O group is
+// always redone, since LY, STAT and the timers change it behind the page
+// tables. Needs a hasher in use.
+uint64_t hashState() {
+  uint64_t root = 0;
+  bool rearm = false;
+  int group, page;
+
+  for (group = 0; group < HASH_GROUPS; group++) {
+    uint64_t dirtyWords[GROUP_PAGES / 8];
+    bool clean = true;
+    memcpy(dirtyWords, hasher->dirty + group * GROUP_PAGES, sizeof(dirtyWords));
+    for (page = 0; page < GROUP_PAGES / 8; page++) {
+      clean &= dirtyWords[page] == 0;
+    }
+
+    if (!clean || group == HASH_GROUPS - 1) {
+      uint64_t hash = 0;
+      for (page = group * GROUP_PAGES; page < (group + 1) * GROUP_PAGES; page++) {
+	if (page >= 0xE0 && page < 0xFE) { // echo RAM, left to the pages it mirrors
+	  hasher->base[page] = pageBase[page];
+	  rearm |= hasher->dirty[page];
+	  hasher->dirty[page] = false;
+	  continue;
+	}
+	if (hasher->dirty[page] || page >= 0xFE) {
+	  hasher->pageHash[page] = hashPage(pageBase[page]);
+	  hasher->base[page] = pageBase[page];
+	  rearm |= hasher->dirty[page];
+	  hasher->dirty[page] = false;
+	}
+	hash = mix(hash, hasher->pageHash[page]);
+      }
+      hasher->groupHash[group] = hash;
+    }
+    root = mix(root, hasher->groupHash[group]);
+  }
+  if (rearm) {
+    refreshPages();
+  }
+  return mix(root, hashMachine());
+}
+
+void initializeStateSet(stateSet *set, bool (*same)(const void *, const void *)) {
+  memset(set, 0, sizeof(*set));
+  set->same = same;
+}
+
+void growStateSet(stateSet *set) {
+  stateEntry *old = set->entries;
+  size_t oldSize = set->size;
+  size_t i;
+
+  set->size = oldSize ? oldSize * 2 : 1024;
+  set->entries = calloc(set->size, sizeof(stateEntry));
+  for (i = 0; i < oldSize; i++) {
+    if (old[i].state != NULL) {
+      size_t slot = old[i].hash & (set->size - 1);
+      while (set->entries[slot].state != NULL) {
+	slot = (slot + 1) & (set->size - 1);
+      }
+      set->entries[slot] = old[i];
+    }
+  }
+  free(old);
+}
+
+// Add a state under its hash. Returns false, leaving the set as it was, if
+// an equal state is already in it.
+bool addState(stateSet *set, uint64_t hash, const void *state) {
+  size_t slot;
+
+  if (set->count * 2 >= set->size) {
+    growStateSet(set);
+  }
+  for (slot = hash & (set->size - 1); set->entries[slot].state != NULL; slot = (slot + 1) & (set->size - 1)) {
+    if (set->entries[slot].hash == hash) {
+      if (set->same(set->entries[slot].state, state)) {
+	return false;
+      }
+      set->collisions++;
+    }
+  }
+  set->entries[slot].hash = hash;
+  set->entries[slot].state = state;
+  set->count++;
+  return true;
+}
+
+void freeStateSet(stateSet *set) {
+  free(set->entries);
+  set->entries = NULL;
+  set->size = set->count = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef STATEHASH_H_INCLUDED
+#define STATEHASH_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_GROUPS 16
+#define GROUP_PAGES (0x100 / HASH_GROUPS)
+
+// A Merkle tree over one machine's address space: a hash per page, one per
+// group of GROUP_PAGES pages, then the root with the registers. Only pages
+// written since they were last hashed, and the groups holding them, are
+// refreshed.
+typedef struct {
+  bool dirty[0x100];
+  const uint8_t *base[0x100]; // what each page hash was taken over
+  uint64_t pageHash[0x100];
+  uint64_t groupHash[HASH_GROUPS];
+} stateHasher;
+
+// Seen states keyed by hash, for dropping duplicates. Entries point at the
+// caller's copy of each state, which same() compares exactly when two
+// hashes match.
+typedef struct {
+  uint64_t hash;
+  const void *state;
+} stateEntry;
+
+typedef struct {
+  stateEntry *entries;
+  size_t size;       // a power of two, or 0 before the first add
+  size_t count;
+  uint64_t collisions; // equal hashes of unequal states
+  bool (*same)(const void *, const void *);
+} stateSet;
+
+extern stateHasher *hasher;
+
+void initializeStateHasher(stateHasher *);
+void useStateHasher(stateHasher *);
+void rebaseStateHasher(stateHasher *, const uint8_t *, const uint8_t *, size_t);
+void markPageDirty(uint8_t);
+uint64_t hashPage(const uint8_t *);
+uint64_t hashState(void);
+uint64_t hashMachine(void);
+void initializeStateSet(stateSet *, bool (*)(const void *, const void *));
+bool addState(stateSet *, uint64_t, const void *);
+void freeStateSet(stateSet *);
+
+#endif
@@ -0,0 +1,115 @@
+#include "timer.h"
+#include "cpu.h"
+#include "interrupts.h"
+#include "memory.h"
+#include "scheduler.h"
+
+timerState timer;
+
+// log2 of the divider period that clocks TIMA, indexed by TAC & 3
+const uint8_t timerShift[4] = { 10, 4, 6, 8 };
+
+// DIV and TIMA are never stepped. DIV is the cycle count since the last
+// reset, TIMA is its value at timaBase plus the divider edges seen since,
+// and the overflow is an event scheduled for the exact cycle it happens.
+// The divider runs off the CPU clock, so in double speed it counts two for
+// every cycle.
+
+uint64_t dividerCounter(uint64_t cycle) {
+  return (cycle - timer.divBase) << cycleShift;
+}
+
+uint64_t timerTicks(uint64_t cycle) {
+  return dividerCounter(cycle) >> timerShift[memory[0xFF07] & 3];
+}
+
+bool timerRunning() {
+  return memory[0xFF07] & 0x04;
+}
+
+uint8_t currentTIMA() {
+  if (!timerRunning()) {
+    return timer.timaValue;
+  }
+  return timer.timaValue + (timerTicks(cycles) - timerTicks(timer.timaBase));
+}
+
+void initializeTimer() {
+  timer.divBase = cycles;
+  timer.timaBase = cycles;
+  timer.timaValue = 0;
+  memory[0xFF06] = 0x00;
+  memory[0xFF07] = 0xF8;
+  scheduleTimer();
+}
+
+void scheduleTimer() {
+  if (!timerRunning()) {
+    cancelEvent(EVENT_TIMER);
+    return;
+  }
+  uint64_t overflowTick = timerTicks(timer.timaBase) + (0x100 - timer.timaValue);
+  scheduleEvent(EVENT_TIMER, timer.divBase +
+		((overflowTick << timerShift[memory[0xFF07] & 3]) >> cycleShift));
+}
+
+void timerOverflow(uint64_t cycle) {
+  timer.timaBase = cycle;
+  timer.timaValue = memory[0xFF06]; // reload from TMA
+  requestInterrupt(INT_TIMER);
+  scheduleTimer();
+}
+
+uint8_t readTimer(uint16_t address) {
+  // an overflow due inside the current instruction has not been run yet
+  if (cycles >= eventCycle[EVENT_TIMER]) {
+    runEvents();
+  }
+
+  if (address == 0xFF04) { // DIV
+    return dividerCounter(cycles) >> 8;
+  }
+  return currentTIMA();
+}
+
+void writeTimer(uint16_t address, uint8_t value) {
+  if (cycles >= eventCycle[EVENT_TIMER]) {
+    runEvents();
+  }
+
+  // fold the edges seen so far into timaValue before anything changes
+  timer.timaValue = currentTIMA();
+  timer.timaBase = cycles;
+
+  switch (address) {
+  case 0xFF04: // DIV, any write resets it
+    timer.divBase = cycles;
+    timer.timaBase = cycles;
+    break;
+  case 0xFF05: // TIMA
+    timer.timaValue = value;
+    break;
+  case 0xFF06: // TMA
+    memory[0xFF06] = value;
+    break;
+  case 0xFF07: // TAC
+    memory[0xFF07] = 0xF8 | value;
+    break;
+  }
+
+  scheduleTimer();
+}
+
+// Change cycleShift, keeping DIV and TIMA where they are.
+void setTimerSpeed(uint8_t shift) {
+  if (cycles >= eventCycle[EVENT_TIMER]) {
+    runEvents();
+  }
+
+  uint64_t counter = dividerCounter(cycles);
+  timer.timaValue = currentTIMA();
+  cycleShift = shift;
+  timer.divBase = cycles - (counter >> shift);
+  timer.timaBase = cycles;
+  scheduleTimer();
+}
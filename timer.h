@@ -0,0 +1,21 @@
+#ifndef TIMER_H_INCLUDED
+#define TIMER_H_INCLUDED
+
+#include <stdint.h>
+
+typedef struct {
+  uint64_t divBase;   // cycle at which the divider was last reset
+  uint64_t timaBase;  // cycle at which timaValue was last valid
+  uint8_t timaValue;
+} timerState;
+
+extern timerState timer;
+
+void initializeTimer(void);
+uint8_t readTimer(uint16_t);
+void writeTimer(uint16_t, uint8_t);
+void scheduleTimer(void);
+void timerOverflow(uint64_t);
+void setTimerSpeed(uint8_t);
+
+#endif
@@ -0,0 +1,364 @@
+// Finds the first instruction where two cores disagree. Both run from the
+// same post-boot template as separate instances, compared by state hash
+// every interval instructions; on a mismatch the interval is bisected from
+// the last agreeing checkpoint down to one instruction, and both states are
+// printed there. The hashes are incremental (statehash.c), so a checkpoint
+// costs the pages dirtied since the last one.
+//
+// Engines are "reference" (executeOpcode, one instruction per step) and
+// "aot" (the ROM recompiled by tools/recompile, see below). A recompiled
+// block runs up to its next branch, so engines only meet where their counts
+// agree and the result can be off by the rest of a block.
+//
+// Runs can also be logged one engine at a time and the logs compared, e.g.
+// across two builds; that narrows it to an interval, to be bisected live.
+// Checkpoints only line up where both engines stop at the same counts, so
+// an aot log is best compared with another aot log.
+//
+//   cc -O2 -I.. -o divergence divergence.c ../instance.c ../aot.c ../boot.c ../capture.c ../cartridge.c ../cgb.c ../cheats.c ../cpu.c ../debugger.c ../dma.c ../flags.c ../interrupts.c ../joypad.c ../memory.c ../metrics.c ../pipeline.c ../ppu.c ../render.c ../savestate.c ../scheduler.c ../shm.c ../statehash.c ../timer.c ../until.c -lm -lrt -lpthread
+//   ./divergence rom [--engines a,b] [--interval n] [--instructions n]
+//   ./divergence rom --log file [--engine name] [--interval n] [--instructions n]
+//   ./divergence --compare log log
+//
+// For the aot engine, add the file tools/recompile made for the same ROM
+// (game_aot.c, as in bench/aotbench.c) to the cc line.
+
+#include "../aot.h"
+#include "../boot.h"
+#include "../debugger.h"
+#include "../instance.h"
+#include "../statehash.h"
+
+#define MAX_SHOWN_BYTES 16
+
+typedef struct {
+  const char *name;
+  bool compiled;
+} engineKind;
+
+const engineKind engineKinds[] = {
+  { "reference", false },
+  { "aot", true },
+};
+
+typedef struct {
+  const engineKind *kind;
+  gbInstance instance;
+  stateHasher hasher;
+  uint64_t count; // instructions retired
+} engine;
+
+instanceTemplate template;
+
+const engineKind *findEngine(const char *name, int length) {
+  size_t i;
+  for (i = 0; i < sizeof(engineKinds) / sizeof(engineKinds[0]); i++) {
+    if ((int) strlen(engineKinds[i].name) == length && strncmp(engineKinds[i].name, name, length) == 0) {
+      return &engineKinds[i];
+    }
+  }
+  printf("Error: unknown engine %.*s\n", length, name);
+  return NULL;
+}
+
+void enterEngine(engine *core) {
+  enterInstance(&core->instance);
+  cycleLimit = NO_EVENT;
+  useStateHasher(&core->hasher);
+}
+
+void leaveEngine(engine *core) {
+  useStateHasher(NULL);
+  leaveInstance(&core->instance);
+}
+
+bool startEngine(engine *core, const engineKind *kind) {
+  core->kind = kind;
+  core->count = 0;
+  initializeStateHasher(&core->hasher);
+  return createInstance(&template, &core->instance);
+}
+
+bool copyEngine(engine *from, engine *to) {
+  to->kind = from->kind;
+  to->count = from->count;
+  initializeStateHasher(&to->hasher);
+  return cloneInstance(&template, &from->instance, &to->instance);
+}
+
+// Step until at least target instructions have retired; returns the hash.
+uint64_t advance(engine *core, uint64_t target) {
+  enterEngine(core);
+  while (core->count < target) {
+    uint64_t before = metrics.instructions;
+    if (core->kind->compiled) {
+      stepAOT();
+    }
+    else {
+      step();
+    }
+    core->count += metrics.instructions - before;
+  }
+  uint64_t hash = hashState();
+  leaveEngine(core);
+  return hash;
+}
+
+// Run both to the first common count at or past target. Returns whether
+// their states agree there.
+bool advanceBoth(engine *a, engine *b, uint64_t target) {
+  uint64_t hashA = advance(a, target);
+  uint64_t hashB = advance(b, target);
+  while (a->count != b->count) {
+    if (a->count < b->count) {
+      hashA = advance(a, b->count);
+    }
+    else {
+      hashB = advance(b, a->count);
+    }
+  }
+  return hashA == hashB;
+}
+
+void showEngine(engine *core) {
+  enterEngine(core);
+  printf("%-9s after %llu instructions, cycle %llu, next opcode %s%02X\n  ", core->kind->name,
+	 (unsigned long long) core->count, (unsigned long long) cycles, prefixCB ? "CB " : "",
+	 peekMemory(pc));
+  printRegisters();
+  leaveEngine(core);
+}
+
+void showMemoryDifferences(const engine *a, const engine *b) {
+  size_t offset;
+  int shown = 0, total = 0;
+  for (offset = 0; offset < a->instance.arenaSize; offset++) {
+    if (a->instance.arena[offset] == b->instance.arena[offset]) {
+      continue;
+    }
+    if (shown++ < MAX_SHOWN_BYTES) {
+      if (offset < MEMORY_SIZE) {
+	printf("  0x%04zX:", offset);
+      }
+      else if (offset < ARENA_SRAM) {
+	printf("  cgb+0x%04zX:", offset - ARENA_CGB);
+      }
+      else {
+	printf("  sram+0x%04zX:", offset - ARENA_SRAM);
+      }
+      printf(" %02X vs %02X\n", a->instance.arena[offset], b->instance.arena[offset]);
+    }
+    total++;
+  }
+  printf("%d bytes of memory differ\n", total);
+}
+
+void freeEngine(engine *core) {
+  freeInstance(&core->instance);
+}
+
+// last agreed, first disagreed: narrow it down from the checkpoints there.
+void bisect(engine *checkA, engine *checkB, uint64_t agreed, uint64_t differed) {
+  engine a, b;
+
+  while (differed - agreed > 1) {
+    uint64_t middle = agreed + (differed - agreed) / 2;
+    if (!copyEngine(checkA, &a) || !copyEngine(checkB, &b)) {
+      return;
+    }
+    bool same = advanceBoth(&a, &b, middle);
+    uint64_t reached = a.count;
+    freeEngine(&a);
+    freeEngine(&b);
+    if (reached >= differed) { // a block stepped over the middle
+      break;
+    }
+    if (same) {
+      agreed = reached;
+    }
+    else {
+      differed = reached;
+    }
+  }
+
+  printf("states agree after %llu instructions and differ after %llu\n",
+	 (unsigned long long) agreed, (unsigned long long) differed);
+  if (!copyEngine(checkA, &a) || !copyEngine(checkB, &b)) {
+    return;
+  }
+  advanceBoth(&a, &b, agreed);
+  printf("before:\n");
+  showEngine(&a);
+  showEngine(&b);
+  advanceBoth(&a, &b, differed);
+  printf("after:\n");
+  showEngine(&a);
+  showEngine(&b);
+  showMemoryDifferences(&a, &b);
+  freeEngine(&a);
+  freeEngine(&b);
+}
+
+int runLive(const engineKind *kindA, const engineKind *kindB, uint64_t interval, uint64_t limit) {
+  engine a, b, checkA, checkB;
+
+  if (!startEngine(&a, kindA) || !startEngine(&b, kindB) ||
+      !copyEngine(&a, &checkA) || !copyEngine(&b, &checkB)) {
+    return 2;
+  }
+  while (checkA.count < limit) {
+    if (!advanceBoth(&a, &b, checkA.count + interval)) {
+      printf("%s and %s differ between instructions %llu and %llu\n", kindA->name, kindB->name,
+	     (unsigned long long) checkA.count, (unsigned long long) a.count);
+      bisect(&checkA, &checkB, checkA.count, a.count);
+      return 1;
+    }
+    freeEngine(&checkA);
+    freeEngine(&checkB);
+    if (!copyEngine(&a, &checkA) || !copyEngine(&b, &checkB)) {
+      return 2;
+    }
+  }
+  printf("%s and %s agree for %llu instructions\n", kindA->name, kindB->name,
+	 (unsigned long long) checkA.count);
+  return 0;
+}
+
+// One line per checkpoint: count, hash, then registers to show on a mismatch.
+int writeLog(const engineKind *kind, const char *path, uint64_t interval, uint64_t limit) {
+  FILE *file = fopen(path, "w");
+  engine core;
+
+  if (file == NULL) {
+    printf("Error: could not write %s\n", path);
+    return 2;
+  }
+  if (!startEngine(&core, kind)) {
+    return 2;
+  }
+  while (core.count < limit) {
+    uint64_t hash = advance(&core, core.count + interval);
+    const cpuState *cpu = &core.instance.cpu;
+    fprintf(file, "%llu %016llx pc=%04X sp=%04X a=%02X f=%02X b=%02X c=%02X d=%02X e=%02X h=%02X l=%02X cycles=%llu\n",
+	    (unsigned long long) core.count, (unsigned long long) hash, cpu->pc, cpu->sp,
+	    cpu->registers[REG_A], cpu->registers[REG_F], cpu->registers[REG_B], cpu->registers[REG_C],
+	    cpu->registers[REG_D], cpu->registers[REG_E], cpu->registers[REG_H], cpu->registers[REG_L],
+	    (unsigned long long) core.instance.cycles);
+  }
+  fclose(file);
+  freeEngine(&core);
+  return 0;
+}
+
+bool readLogLine(FILE *file, char *line, int size, unsigned long long *count, unsigned long long *hash) {
+  while (fgets(line, size, file) != NULL) {
+    if (sscanf(line, "%llu %llx", count, hash) == 2) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int compareLogs(const char *pathA, const char *pathB) {
+  FILE *fileA = fopen(pathA, "r");
+  FILE *fileB = fopen(pathB, "r");
+  char lineA[256], lineB[256];
+  unsigned long long countA, countB, hashA, hashB, agreed = 0;
+
+  if (fileA == NULL || fileB == NULL) {
+    printf("Error: could not open %s\n", fileA == NULL ? pathA : pathB);
+    return 2;
+  }
+  bool moreA = readLogLine(fileA, lineA, sizeof(lineA), &countA, &hashA);
+  bool moreB = readLogLine(fileB, lineB, sizeof(lineB), &countB, &hashB);
+  while (moreA && moreB) {
+    if (countA < countB) {
+      moreA = readLogLine(fileA, lineA, sizeof(lineA), &countA, &hashA);
+    }
+    else if (countB < countA) {
+      moreB = readLogLine(fileB, lineB, sizeof(lineB), &countB, &hashB);
+    }
+    else if (hashA != hashB) {
+      printf("logs agree at %llu instructions and differ at %llu\n%s: %s%s: %s", agreed, countA,
+	     pathA, lineA, pathB, lineB);
+      return 1;
+    }
+    else {
+      agreed = countA;
+      moreA = readLogLine(fileA, lineA, sizeof(lineA), &countA, &hashA);
+      moreB = readLogLine(fileB, lineB, sizeof(lineB), &countB, &hashB);
+    }
+  }
+  printf("logs agree up to %llu instructions\n", agreed);
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  const char *romPath = NULL;
+  const char *logPath = NULL;
+  const char *engines = "reference,aot";
+  uint64_t interval = 10000;
+  uint64_t limit = 10000000;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--compare") == 0 && i + 2 < argc) {
+      return compareLogs(argv[i + 1], argv[i + 2]);
+    }
+    else if ((strcmp(argv[i], "--engines") == 0 || strcmp(argv[i], "--engine") == 0) && i + 1 < argc) {
+      engines = argv[++i];
+    }
+    else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+      interval = strtoull(argv[++i], NULL, 0);
+    }
+    else if (strcmp(argv[i], "--instructions") == 0 && i + 1 < argc) {
+      limit = strtoull(argv[++i], NULL, 0);
+    }
+    else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+      logPath = argv[++i];
+    }
+    else if (argv[i][0] != '-' && romPath == NULL) {
+      romPath = argv[i];
+    }
+    else {
+      romPath = NULL;
+      break;
+    }
+  }
+  if (romPath == NULL || interval == 0) {
+    printf("usage: %s rom [--engines a,b] [--interval n] [--instructions n]\n"
+	   "       %s rom --log file [--engine name] [--interval n] [--instructions n]\n"
+	   "       %s --compare log log\n", argv[0], argv[0], argv[0]);
+    return 2;
+  }
+
+  traceEnabled = false;
+  if (!loadROM(romPath)) {
+    return 2;
+  }
+  fastBoot(MODEL_DMG);
+  if (!createTemplate(&template)) {
+    return 2;
+  }
+
+  const char *comma = strchr(engines, ',');
+  const engineKind *kindA = findEngine(engines, comma ? comma - engines : (int) strlen(engines));
+  if (kindA == NULL) {
+    return 2;
+  }
+  if (logPath != NULL) {
+    if (kindA->compiled && !initializeAOT()) {
+      return 2;
+    }
+    return writeLog(kindA, logPath, interval, limit);
+  }
+  const engineKind *kindB = comma ? findEngine(comma + 1, strlen(comma + 1)) : NULL;
+  if (kindB == NULL) {
+    printf("Error: two engines are needed, e.g. --engines reference,aot\n");
+    return 2;
+  }
+  if ((kindA->compiled || kindB->compiled) && !initializeAOT()) {
+    return 2;
+  }
+  return runLive(kindA, kindB, interval, limit);
+}
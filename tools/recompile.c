@@ -0,0 +1,325 @@
+// Translates the code reachable in a ROM to C that the AOT runner can link
+// in place of interpreting it.
+//
+//   cc -O2 -I.. -o recompile recompile.c ../aot.c ../boot.c ../capture.c ../cartridge.c ../cgb.c ../cheats.c ../cpu.c ../debugger.c ../dma.c ../flags.c ../interrupts.c ../joypad.c ../memory.c ../metrics.c ../pipeline.c ../ppu.c ../render.c ../savestate.c ../scheduler.c ../shm.c ../statehash.c ../timer.c ../until.c -lm -lrt -lpthread
+//   ./recompile game.gb ../cpu.c game_aot.c
+//
+// then build the emulator with game_aot.c added and run it with --aot.
+//
+// Code is traced from 0x0100 and the RST and interrupt vectors. Each
+// instruction's C is the body of its case in executeOpcode, read from
+// cpu.c, so the translation has exactly the interpreter's semantics. Where
+// control goes is found the same way: every instruction is run in a scratch
+// machine with the flags all clear and all set, and with two different sets
+// of register and stack contents. A successor that moves with the data
+// (JP (HL), RET) is left for the runtime; so is code outside
+// 0x0000-0x7FFF and anything in a bank other than 1.
+
+#include "../aot.h"
+#include "../boot.h"
+
+#define MAX_BLOCK_INSTRUCTIONS 64
+#define MAX_LINE 512
+
+typedef struct {
+  bool known;
+  bool straight;       // falls through to next and nothing else
+  uint16_t next;
+  int successorCount;
+  uint16_t successors[4];
+} instructionFlow;
+
+char *normalBodies[0x100];
+char *extendedBodies[0x100];
+instructionFlow flows[2][0x8000];
+bool blockQueued[0x8000];
+uint16_t worklist[0x8000];
+int worklistCount = 0;
+int blockCount;
+uint8_t romImage[0x8000];
+
+char *trim(char *line) {
+  char *end;
+  while (*line == ' ' || *line == '\t') {
+    line++;
+  }
+  end = line + strlen(line);
+  while (end > line && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ')) {
+    *--end = '\0';
+  }
+  return line;
+}
+
+// Collect the statements of every case in the two switches of
+// executeOpcode, up to their break.
+bool readHandlers(const char *path) {
+  FILE *file = fopen(path, "r");
+  char line[MAX_LINE];
+  char body[4096];
+  bool inFunction = false;
+  int switchIndex = -1;
+  int opcode = -1;
+
+  if (file == NULL) {
+    printf("Error: could not open %s\n", path);
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (!inFunction) {
+      inFunction = strncmp(line, "void executeOpcode(", 19) == 0;
+      continue;
+    }
+    if (line[0] == '}') {
+      break;
+    }
+
+    char *text = trim(line);
+    unsigned int value;
+    if (strncmp(text, "switch(opcode)", 14) == 0) {
+      switchIndex++;
+    }
+    else if (switchIndex >= 0 && sscanf(text, "case 0%*[xX]%x:", &value) == 1) {
+      opcode = value;
+      body[0] = '\0';
+    }
+    else if (opcode >= 0 && strcmp(text, "break;") == 0) {
+      char **bodies = switchIndex == 0 ? normalBodies : extendedBodies;
+      bodies[opcode] = strdup(body);
+      opcode = -1;
+    }
+    else if (opcode >= 0 && strlen(body) + strlen(text) + 2 < sizeof(body)) {
+      strcat(body, text);
+      strcat(body, "\n");
+    }
+  }
+  fclose(file);
+
+  if (switchIndex != 1) {
+    printf("Error: could not find the opcode switches in %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+// Run one instruction in a fresh machine and return where pc ends up.
+uint16_t probe(uint16_t address, bool extended, uint8_t flags, int variant, uint16_t *returnAddress) {
+  resetMachine();
+  unmapBootROM();
+  memory[0xFF50] = 0x01;
+
+  writeReg(REG_AF, (variant ? 0x5A00 : 0xA500) | flags);
+  writeReg(REG_BC, variant ? 0xC321 : 0xC123);
+  writeReg(REG_DE, variant ? 0xC654 : 0xC456);
+  writeReg(REG_HL, variant ? 0xC987 : 0xC789);
+  sp = 0xD000;
+  memory[0xD000] = variant ? 0x11 : 0x55;
+  memory[0xD001] = variant ? 0x22 : 0x66;
+  pc = address;
+  prefixCB = extended;
+
+  executeOpcode(readNextByte());
+
+  *returnAddress = 0;
+  if (sp < 0xD000) { // pushed something, i.e. a call: it will come back
+    uint16_t target = pc;
+    *returnAddress = popWord();
+    pc = target;
+  }
+  return pc;
+}
+
+void addSuccessor(instructionFlow *flow, uint16_t address) {
+  int i;
+  for (i = 0; i < flow->successorCount; i++) {
+    if (flow->successors[i] == address) {
+      return;
+    }
+  }
+  if (flow->successorCount < 4) {
+    flow->successors[flow->successorCount++] = address;
+  }
+}
+
+const instructionFlow *analyze(uint16_t address, bool extended) {
+  instructionFlow *flow = &flows[extended][address];
+  uint16_t targets[2][2], returns[2][2];
+  int f, v;
+
+  if (flow->known) {
+    return flow;
+  }
+  flow->known = true;
+
+  for (f = 0; f < 2; f++) {
+    for (v = 0; v < 2; v++) {
+      targets[f][v] = probe(address, extended, f ? 0xF0 : 0x00, v, &returns[f][v]);
+    }
+  }
+
+  uint16_t next = targets[0][0];
+  flow->straight = targets[0][1] == next && targets[1][0] == next && targets[1][1] == next &&
+    next > address && next <= address + 4 && returns[0][0] == 0;
+  flow->next = next;
+  if (flow->straight) {
+    return flow;
+  }
+
+  for (f = 0; f < 2; f++) {
+    if (targets[f][0] == targets[f][1]) {
+      addSuccessor(flow, targets[f][0]);
+    }
+    if (returns[f][0] != 0 && returns[f][0] == returns[f][1]) {
+      addSuccessor(flow, returns[f][0]);
+    }
+  }
+  return flow;
+}
+
+void queueBlock(uint16_t address) {
+  if (address < 0x8000 && !blockQueued[address]) {
+    blockQueued[address] = true;
+    worklist[worklistCount++] = address;
+  }
+}
+
+void emitInstruction(FILE *out, uint16_t address, bool extended, const char *body,
+		     const instructionFlow *flow, bool last) {
+  uint8_t opcode = romImage[address];
+  int length = extended ? 1 : opcodeLength[opcode];
+  uint8_t byteA = length >= 2 ? romImage[(address + 1) & 0x7FFF] : 0;
+  uint8_t byteB = length >= 3 ? romImage[(address + 2) & 0x7FFF] : 0;
+  int cost = extended ? ((opcode & 0x07) != 0x06 ? 4 : (opcode & 0xC0) == 0x40 ? 8 : 12)
+    : opcodeCycles[opcode];
+  char text[4096];
+  char *line;
+
+  fprintf(out, "  // 0x%04X: %s%02X", address, extended ? "CB " : "", opcode);
+  if (length >= 2) {
+    fprintf(out, " %02X", byteA);
+  }
+  if (length >= 3) {
+    fprintf(out, " %02X", byteB);
+  }
+  fprintf(out, "\n  pc = 0x%04X;\n", address + length);
+  fprintf(out, "  cycles += %d >> cycleShift;\n", cost);
+  fprintf(out, "  {\n");
+  if (strstr(body, "opcode") != NULL) {
+    fprintf(out, "    const uint8_t opcode = 0x%02X;\n", opcode);
+  }
+  if (strstr(body, "byteA") != NULL) {
+    fprintf(out, "    const uint8_t byteA = 0x%02X;\n", byteA);
+  }
+  if (strstr(body, "byteB") != NULL) {
+    fprintf(out, "    const uint8_t byteB = 0x%02X;\n", byteB);
+  }
+  strcpy(text, body);
+  for (line = strtok(text, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+    fprintf(out, "    %s\n", line);
+  }
+  fprintf(out, "  }\n");
+  if (extended) {
+    fprintf(out, "  prefixCB = false;\n");
+  }
+  if (flow->straight && !last) {
+    fprintf(out, "  AOT_NEXT(0x%04X);\n", flow->next);
+  }
+  else {
+    fprintf(out, "  AOT_STEP_END();\n");
+  }
+}
+
+// Straight-line code from start up to the first branch, page change or
+// instruction the interpreter does not implement. Without an output this
+// only finds the blocks; with one it also stops where another block starts,
+// so each instruction is translated once.
+void traceBlock(FILE *out, uint16_t start) {
+  uint16_t address = start;
+  bool extended = false;
+  int count = 0;
+
+  if (out != NULL) {
+    fprintf(out, "static void block_%04X(void) {\n", start);
+  }
+  for (;;) {
+    uint8_t opcode = romImage[address];
+    const char *body = extended ? extendedBodies[opcode] : normalBodies[opcode];
+    if (body == NULL) {
+      break; // the runtime falls back to the interpreter, which reports it
+    }
+
+    const instructionFlow *flow = analyze(address, extended);
+    bool prefix = !extended && opcode == 0xCB;
+    bool last = !flow->straight || flow->next >= 0x8000 ||
+      (!prefix && ((flow->next >> 8) != (start >> 8) || ++count >= MAX_BLOCK_INSTRUCTIONS ||
+		   (out != NULL && blockQueued[flow->next])));
+    if (out != NULL) {
+      emitInstruction(out, address, extended, body, flow, last);
+    }
+
+    if (!flow->straight) {
+      int i;
+      for (i = 0; i < flow->successorCount; i++) {
+	queueBlock(flow->successors[i]);
+      }
+      break;
+    }
+    if (last) {
+      queueBlock(flow->next);
+      break;
+    }
+    address = flow->next;
+    extended = prefix;
+  }
+  if (out != NULL) {
+    fprintf(out, "}\n\n");
+  }
+}
+
+int main(int argc, const char* argv[]) {
+  static const uint16_t entries[] = {
+    0x0100, 0x0000, 0x0008, 0x0010, 0x0018, 0x0020, 0x0028, 0x0030, 0x0038,
+    0x0040, 0x0048, 0x0050, 0x0058, 0x0060
+  };
+  int i;
+
+  if (argc < 4) {
+    printf("usage: %s <rom> <cpu.c> <output.c>\n", argv[0]);
+    return 1;
+  }
+  traceEnabled = false;
+  if (!loadROM(argv[1]) || !readHandlers(argv[2])) {
+    return 1;
+  }
+  memset(romImage, 0, sizeof(romImage));
+  memcpy(romImage, rom, romSize < 0x8000 ? romSize : 0x8000);
+
+  FILE *out = fopen(argv[3], "w");
+  if (out == NULL) {
+    printf("Error: could not write %s\n", argv[3]);
+    return 1;
+  }
+  fprintf(out, "// Generated by tools/recompile from %s. Do not edit.\n\n#include \"aot.h\"\n\n", argv[1]);
+
+  for (i = 0; i < (int) (sizeof(entries) / sizeof(entries[0])); i++) {
+    queueBlock(entries[i]);
+  }
+  for (i = 0; i < worklistCount; i++) {
+    traceBlock(NULL, worklist[i]);
+  }
+  blockCount = worklistCount;
+  for (i = 0; i < blockCount; i++) {
+    traceBlock(out, worklist[i]);
+  }
+
+  fprintf(out, "static const aotBlock blocks[] = {\n");
+  for (i = 0; i < blockCount; i++) {
+    fprintf(out, "  { 0x%04X, block_%04X },\n", worklist[i], worklist[i]);
+  }
+  fprintf(out, "};\n\nconst aotProgram compiledProgram = { 0x%08X, %d, blocks };\n",
+	  romChecksum(), blockCount);
+  fclose(out);
+
+  printf("%d blocks from %s\n", blockCount, argv[1]);
+  return 0;
+}
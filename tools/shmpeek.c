@@ -0,0 +1,59 @@
+// Prints a consistent snapshot of an exported segment: the frame number,
+// the start of WRAM and HRAM, a checksum of the framebuffer and the main
+// counters.
+//
+//   cc -O2 -I.. -o shmpeek shmpeek.c ../shmread.c -lrt
+//   ./shmpeek /gb0
+
+#include <stdio.h>
+#include "../shm.h"
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    printf("usage: %s <segment name>\n", argv[0]);
+    return 1;
+  }
+
+  shmHeader *header = mapSharedMemory(argv[1]);
+  if (header == NULL) {
+    printf("Error: could not map %s\n", argv[1]);
+    return 1;
+  }
+
+  const shmSnapshot *shared;
+  metricsSnapshot metrics;
+  uint8_t wram[16], hram[16];
+  uint64_t frame;
+  uint32_t checksum, sequence;
+  int i;
+
+  do {
+    shared = beginSharedRead(header, &sequence);
+    frame = shared->frame;
+    for (i = 0; i < 16; i++) {
+      wram[i] = shared->wram[i];
+      hram[i] = shared->hram[i];
+    }
+    checksum = 0;
+    for (i = 0; i < SHM_FRAMEBUFFER_SIZE; i++) {
+      checksum = checksum * 31 + shared->framebuffer[i];
+    }
+    metrics = shared->metrics;
+  } while (retrySharedRead(shared, sequence));
+
+  printf("frame %llu\n", (unsigned long long) frame);
+  printf("WRAM 0xC000:");
+  for (i = 0; i < 16; i++) {
+    printf(" %02X", wram[i]);
+  }
+  printf("\nHRAM 0xFF80:");
+  for (i = 0; i < 16; i++) {
+    printf(" %02X", hram[i]);
+  }
+  printf("\nframebuffer checksum: %08X\n", checksum);
+  printf("cycles %llu, instructions %llu, halt cycles %llu, bank switches %llu\n",
+	 (unsigned long long) metrics.cycles, (unsigned long long) metrics.counters.instructions,
+	 (unsigned long long) metrics.counters.haltCycles,
+	 (unsigned long long) metrics.counters.bankSwitches);
+  return 0;
+}
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "until.h"
+#include "cpu.h"
+#include "debugger.h"
+#include "memory.h"
+#include "scheduler.h"
+
+// Scripted runs: go until one of a set of conditions holds. Conditions are
+// sorted by what it takes to notice them. Cycle and frame counts only move
+// the point where the frame loop stops, and serial text is matched as it is
+// sent, so a run with only those goes exactly like runFrame. PC, opcode and
+// memory conditions need a check after every instruction, done from a PC
+// bitmap and an opcode table.
+
+untilCondition untilConditions[MAX_UNTIL];
+int untilCount = 0;
+
+uint8_t untilPCMap[0x2000];
+bool untilOpcodes[0x100];
+int pcConditions, opcodeConditions, memoryConditions, serialConditions;
+
+// the end of the serial output, oldest first
+char serialTail[UNTIL_TEXT_LENGTH];
+int untilHit = -1;
+bool untilRunning = false;
+bool frameOpen = false; // the last run stopped mid-frame
+
+bool parseNumber(const char *text, uint64_t *value) {
+  char *end;
+  if (*text == '\0') {
+    return false;
+  }
+  *value = strtoull(text, &end, 0);
+  return *end == '\0';
+}
+
+// Parse a condition, e.g. "pc=0x0150", "mem=0xC000:0x42" or "serial=Passed".
+bool addUntil(const char *spec) {
+  untilCondition condition;
+  const char *value = strchr(spec, '=');
+  uint64_t number, byte;
+
+  memset(&condition, 0, sizeof(condition));
+  if (untilCount == MAX_UNTIL || value == NULL) {
+    printf("Error: bad run-until condition %s\n", spec);
+    return false;
+  }
+  value++;
+
+  if (strncmp(spec, "pc=", 3) == 0 && parseNumber(value, &number) && number <= 0xFFFF) {
+    condition.type = UNTIL_PC;
+    condition.address = number;
+    pcConditions++;
+    untilPCMap[number >> 3] |= 1 << (number & 7);
+  }
+  else if (strncmp(spec, "opcode=", 7) == 0 && parseNumber(value, &number) && number <= 0xFF) {
+    condition.type = UNTIL_OPCODE;
+    condition.address = number;
+    opcodeConditions++;
+    untilOpcodes[number] = true;
+  }
+  else if (strncmp(spec, "mem=", 4) == 0 && strchr(value, ':') != NULL) {
+    char address[16];
+    int length = strchr(value, ':') - value;
+    if (length >= (int) sizeof(address)) {
+      length = sizeof(address) - 1;
+    }
+    memcpy(address, value, length);
+    address[length] = '\0';
+    if (!parseNumber(address, &number) || number > 0xFFFF ||
+	!parseNumber(value + length + 1, &byte) || byte > 0xFF) {
+      printf("Error: bad run-until condition %s\n", spec);
+      return false;
+    }
+    condition.type = UNTIL_MEMORY;
+    condition.address = number;
+    condition.value = byte;
+    memoryConditions++;
+  }
+  else if (strncmp(spec, "serial=", 7) == 0 && *value && strlen(value) < UNTIL_TEXT_LENGTH) {
+    condition.type = UNTIL_SERIAL;
+    strcpy(condition.text, value);
+    serialConditions++;
+  }
+  else if (strncmp(spec, "cycles=", 7) == 0 && parseNumber(value, &number)) {
+    condition.type = UNTIL_CYCLES;
+    condition.count = number;
+  }
+  else if (strncmp(spec, "frames=", 7) == 0 && parseNumber(value, &number)) {
+    condition.type = UNTIL_FRAMES;
+    condition.count = number;
+  }
+  else {
+    printf("Error: bad run-until condition %s\n", spec);
+    return false;
+  }
+
+  untilConditions[untilCount++] = condition;
+  return true;
+}
+
+void clearUntil() {
+  untilCount = 0;
+  pcConditions = opcodeConditions = memoryConditions = serialConditions = 0;
+  memset(untilPCMap, 0, sizeof(untilPCMap));
+  memset(untilOpcodes, 0, sizeof(untilOpcodes));
+  memset(serialTail, 0, sizeof(serialTail));
+}
+
+// First condition of a type that holds now, or -1.
+int findUntil(untilType type) {
+  int i;
+  for (i = 0; i < untilCount; i++) {
+    untilCondition *condition = &untilConditions[i];
+    if (condition->type != type) {
+      continue;
+    }
+    if ((type == UNTIL_PC && condition->address == pc) ||
+	(type == UNTIL_OPCODE && condition->address == peekMemory(pc)) ||
+	(type == UNTIL_MEMORY && peekMemory(condition->address) == condition->value)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// The per-instruction check, only used with PC, opcode or memory conditions.
+// A hit already set, e.g. by serial output during the instruction, stands.
+bool untilStep() {
+  if (untilHit >= 0) {
+    return true;
+  }
+  if (pcConditions && (untilPCMap[pc >> 3] & (1 << (pc & 7)))) {
+    untilHit = findUntil(UNTIL_PC);
+  }
+  if (untilHit < 0 && opcodeConditions && !prefixCB && untilOpcodes[peekMemory(pc)]) {
+    untilHit = findUntil(UNTIL_OPCODE);
+  }
+  if (untilHit < 0 && memoryConditions) {
+    untilHit = findUntil(UNTIL_MEMORY);
+  }
+  return untilHit >= 0;
+}
+
+// Called with each byte sent over serial.
+void serialOutput(uint8_t value) {
+  int i;
+  if (!serialConditions || !untilRunning) {
+    return;
+  }
+  memmove(serialTail, serialTail + 1, UNTIL_TEXT_LENGTH - 2);
+  serialTail[UNTIL_TEXT_LENGTH - 2] = value;
+  for (i = 0; i < untilCount && untilHit < 0; i++) {
+    int length = strlen(untilConditions[i].text);
+    if (untilConditions[i].type == UNTIL_SERIAL &&
+	memcmp(serialTail + UNTIL_TEXT_LENGTH - 1 - length, untilConditions[i].text, length) == 0) {
+      untilHit = i;
+      cycleLimit = cycles; // stop after this instruction
+    }
+  }
+}
+
+// Run frames until a condition holds and return its index. A run that stops
+// mid-frame leaves the frame open for the next one to finish.
+int runUntil() {
+  uint64_t cycleTarget = NO_EVENT;
+  uint64_t frameTarget = UINT64_MAX;
+  int cycleIndex = -1, frameIndex = -1;
+  bool perStep = pcConditions || opcodeConditions || memoryConditions;
+  int i;
+
+  for (i = 0; i < untilCount; i++) {
+    if (untilConditions[i].type == UNTIL_CYCLES && cycles + untilConditions[i].count < cycleTarget) {
+      cycleTarget = cycles + untilConditions[i].count;
+      cycleIndex = i;
+    }
+    if (untilConditions[i].type == UNTIL_FRAMES && frameCount + untilConditions[i].count < frameTarget) {
+      frameTarget = frameCount + untilConditions[i].count;
+      frameIndex = i;
+    }
+  }
+
+  untilHit = -1;
+  untilRunning = true;
+  if (perStep) {
+    untilStep();
+  }
+  while (untilHit < 0) {
+    if (cycles >= cycleTarget) {
+      untilHit = cycleIndex;
+      break;
+    }
+    if (frameCount >= frameTarget) {
+      untilHit = frameIndex;
+      break;
+    }
+
+    if (!frameOpen) {
+      beginFrame();
+      frameOpen = true;
+    }
+    uint64_t frameEnd = (frameCount + 1) * CYCLES_PER_FRAME;
+    cycleLimit = frameEnd < cycleTarget ? frameEnd : cycleTarget;
+    if (perStep) {
+      while (cycles < cycleLimit) {
+	step();
+	if (untilStep()) {
+	  break;
+	}
+      }
+    }
+    else {
+      while (cycles < cycleLimit) {
+	step();
+      }
+    }
+    if (cycles >= frameEnd) {
+      endFrame();
+      frameOpen = false;
+    }
+  }
+
+  untilRunning = false;
+  return untilHit;
+}
+
+void describeUntil(int index) {
+  untilCondition *condition = &untilConditions[index];
+  switch (condition->type) {
+  case UNTIL_PC:
+    printf("until: pc 0x%04X\n", condition->address);
+    break;
+  case UNTIL_OPCODE:
+    printf("until: opcode 0x%02X at 0x%04X\n", condition->address, pc);
+    break;
+  case UNTIL_MEMORY:
+    printf("until: 0x%04X is 0x%02X\n", condition->address, condition->value);
+    break;
+  case UNTIL_SERIAL:
+    printf("until: serial \"%s\"\n", condition->text);
+    break;
+  case UNTIL_CYCLES:
+    printf("until: %llu cycles\n", (unsigned long long) condition->count);
+    break;
+  case UNTIL_FRAMES:
+    printf("until: %llu frames\n", (unsigned long long) condition->count);
+    break;
+  }
+}
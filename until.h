@@ -0,0 +1,36 @@
+#ifndef UNTIL_H_INCLUDED
+#define UNTIL_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_UNTIL 16
+#define UNTIL_TEXT_LENGTH 64
+
+typedef enum {
+  UNTIL_PC,      // pc=ADDR, before the instruction there runs
+  UNTIL_OPCODE,  // opcode=OP, before an instruction with that opcode runs
+  UNTIL_MEMORY,  // mem=ADDR:VALUE, once the byte holds the value
+  UNTIL_SERIAL,  // serial=TEXT, once the serial output ends with the text
+  UNTIL_CYCLES,  // cycles=N, N cycles into the run
+  UNTIL_FRAMES   // frames=N, N frames into the run
+} untilType;
+
+typedef struct {
+  untilType type;
+  uint16_t address; // pc, opcode or memory address
+  uint8_t value;
+  uint64_t count;
+  char text[UNTIL_TEXT_LENGTH];
+} untilCondition;
+
+extern untilCondition untilConditions[MAX_UNTIL];
+extern int untilCount;
+
+bool addUntil(const char *);
+void clearUntil(void);
+int runUntil(void);
+void describeUntil(int);
+void serialOutput(uint8_t);
+
+#endif